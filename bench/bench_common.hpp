@@ -0,0 +1,207 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace bench
+{
+  // ── types ──────────────────────────────────────────────────────────────────
+  struct Frame
+  {
+    size_t offset;
+    size_t size;
+    bool idr;
+  };
+
+  struct Stream
+  {
+    std::vector<uint8_t> data;
+    std::vector<Frame> frames;
+  };
+
+  struct SynthConfig
+  {
+    int frames = 300;
+    int idr_period = 30;      // one IDR every N frames
+    size_t idr_bytes = 120000;
+    size_t p_bytes = 12000;
+    int slices = 1;           // slices per picture
+    uint32_t seed = 1;
+  };
+
+  // ── timing ─────────────────────────────────────────────────────────────────
+  using Clock = std::chrono::steady_clock;
+
+  inline double elapsed_ns(Clock::time_point start)
+  {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  }
+
+  // ── synthetic streams ──────────────────────────────────────────────────────
+  // NAL payload bytes are random but never form 00 00 0x (x <= 3), the same
+  // guarantee emulation prevention gives a real encoder bitstream.
+  inline void append_nal(std::vector<uint8_t> &out, uint8_t header, size_t size, std::mt19937 &rng)
+  {
+    out.insert(out.end(), {0x00, 0x00, 0x00, 0x01, header});
+    int zeros = 0;
+    for (size_t i = 1; i < size; i++)
+    {
+      uint8_t b = static_cast<uint8_t>(rng());
+      if (zeros >= 2 && b <= 3)
+        b = 0x03;
+      zeros = (b == 0x00) ? zeros + 1 : 0;
+      out.push_back(b);
+    }
+  }
+
+  inline Stream synth_stream(const SynthConfig &cfg)
+  {
+    Stream s;
+    std::mt19937 rng(cfg.seed);
+    std::uniform_real_distribution<double> jitter(0.7, 1.3);
+
+    for (int f = 0; f < cfg.frames; f++)
+    {
+      bool idr = cfg.idr_period > 0 && (f % cfg.idr_period) == 0;
+      size_t begin = s.data.size();
+
+      if (idr)
+      {
+        append_nal(s.data, 0x67, 12, rng); // SPS
+        append_nal(s.data, 0x68, 4, rng);  // PPS
+      }
+
+      size_t bytes = static_cast<size_t>((idr ? cfg.idr_bytes : cfg.p_bytes) * jitter(rng));
+      int slices = cfg.slices > 0 ? cfg.slices : 1;
+      for (int i = 0; i < slices; i++)
+        append_nal(s.data, idr ? 0x65 : 0x41, bytes / slices + 1, rng);
+
+      s.frames.push_back({begin, s.data.size() - begin, idr});
+    }
+    return s;
+  }
+
+  // Baseline 4:2:0 JFIF frames as the JPEG encoder produces them: DQT with
+  // luma and chroma tables, SOF0, a DHT, SOS and random byte-stuffed scan data
+  // (0xFF is always followed by 0x00) closed by EOI
+  inline void append_jpeg(std::vector<uint8_t> &out, uint16_t width, uint16_t height, size_t scan_bytes,
+                          uint16_t restart_interval, std::mt19937 &rng)
+  {
+    out.insert(out.end(), {0xFF, 0xD8, 0xFF, 0xDB, 0x00, 2 + 2 * 65});
+    for (uint8_t table = 0; table < 2; table++)
+    {
+      out.push_back(table);
+      for (int i = 0; i < 64; i++)
+        out.push_back(static_cast<uint8_t>(1 + (rng() % 50)));
+    }
+
+    out.insert(out.end(), {0xFF, 0xC0, 0x00, 17, 8,
+                           static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height),
+                           static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width), 3,
+                           1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1});
+    if (restart_interval)
+      out.insert(out.end(), {0xFF, 0xDD, 0x00, 4, static_cast<uint8_t>(restart_interval >> 8),
+                             static_cast<uint8_t>(restart_interval)});
+    // Table contents do not matter to RTP/JPEG, only the segment framing
+    out.insert(out.end(), {0xFF, 0xC4, 0x00, 2 + 17});
+    out.insert(out.end(), 17, 0x00);
+    out.insert(out.end(), {0xFF, 0xDA, 0x00, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0});
+
+    for (size_t i = 0; i < scan_bytes; i++)
+    {
+      uint8_t b = static_cast<uint8_t>(rng());
+      out.push_back(b);
+      if (b == 0xFF)
+        out.push_back(0x00);
+    }
+    out.insert(out.end(), {0xFF, 0xD9});
+  }
+
+  inline Stream synth_jpeg_stream(int frames, uint16_t width, uint16_t height, size_t frame_bytes,
+                                  uint16_t restart_interval = 0, uint32_t seed = 1)
+  {
+    Stream s;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> jitter(0.85, 1.15);
+    for (int f = 0; f < frames; f++)
+    {
+      size_t begin = s.data.size();
+      append_jpeg(s.data, width, height, static_cast<size_t>(frame_bytes * jitter(rng)), restart_interval, rng);
+      s.frames.push_back({begin, s.data.size() - begin, true});
+    }
+    return s;
+  }
+
+  // ── recorded streams ───────────────────────────────────────────────────────
+  // Splits a raw Annex B file into access units: a new frame starts at every
+  // slice NAL whose first_mb_in_slice is 0 (leading bit of the slice header).
+  inline bool load_stream(const char *path, Stream &s)
+  {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+      return false;
+
+    uint8_t buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      s.data.insert(s.data.end(), buf, buf + n);
+    fclose(f);
+
+    const uint8_t *d = s.data.data();
+    size_t size = s.data.size();
+    size_t frame_begin = 0;
+    bool have_slice = false, idr = false;
+
+    for (size_t i = 0; i + 4 < size; i++)
+    {
+      if (d[i] != 0 || d[i + 1] != 0 || d[i + 2] != 1)
+        continue;
+
+      size_t sc = (i > 0 && d[i - 1] == 0) ? i - 1 : i;
+      uint8_t type = d[i + 3] & 0x1F;
+      bool slice = (type == 1 || type == 5);
+      bool first_mb_zero = slice && (d[i + 4] & 0x80);
+
+      // Parameter sets / SEI or a new picture close the previous frame
+      if (have_slice && (!slice || first_mb_zero))
+      {
+        s.frames.push_back({frame_begin, sc - frame_begin, idr});
+        frame_begin = sc;
+        have_slice = false;
+        idr = false;
+      }
+      if (slice)
+      {
+        have_slice = true;
+        idr |= (type == 5);
+      }
+      i += 2;
+    }
+
+    if (frame_begin < size)
+      s.frames.push_back({frame_begin, size - frame_begin, idr});
+    return !s.frames.empty();
+  }
+
+  inline Stream load_or_synth(int argc, char **argv, const SynthConfig &cfg = {})
+  {
+    Stream s;
+    if (argc > 1)
+    {
+      if (load_stream(argv[1], s))
+      {
+        printf("Stream: %s (%zu frames, %zu bytes)\n", argv[1], s.frames.size(), s.data.size());
+        return s;
+      }
+      fprintf(stderr, "Failed to load %s, using a synthetic stream\n", argv[1]);
+      s = {};
+    }
+    s = synth_stream(cfg);
+    printf("Stream: synthetic (%zu frames, %zu bytes)\n", s.frames.size(), s.data.size());
+    return s;
+  }
+
+} // namespace bench
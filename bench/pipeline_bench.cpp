@@ -0,0 +1,197 @@
+// Capture -> send handoff: cost of the SPSCQueue between two threads, and
+// frame rate of a serial loop versus the two-stage pipeline under modelled
+// stage times (sensor at 30 fps, encoder wait, send incl. sendto stalls).
+// Stage times are sleeps, so the pipeline rows reflect scheduling, not CPU.
+//   pipeline_bench
+
+#include "bench_common.hpp"
+#include "stream_pipeline_mod.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace
+{
+  using namespace std::chrono;
+
+  struct Handle
+  {
+    uint32_t sequence;
+    int index;
+  };
+
+  // ── SPSC handoff ───────────────────────────────────────────────────────────
+  double handoff_ns(size_t capacity, uint32_t items)
+  {
+    SPSCQueue<Handle> queue(capacity);
+    uint64_t sum = 0;
+    auto start = bench::Clock::now();
+
+    std::thread consumer([&]
+                         {
+      Handle h;
+      for (uint32_t received = 0; received < items;)
+      {
+        if (queue.pop(h))
+        {
+          sum += h.sequence;
+          received++;
+        }
+        else
+        {
+          std::this_thread::yield();
+        }
+      } });
+
+    for (uint32_t i = 0; i < items;)
+    {
+      if (queue.push({i, 0}))
+        i++;
+      else
+        std::this_thread::yield();
+    }
+    consumer.join();
+
+    double ns = bench::elapsed_ns(start) / items;
+    if (sum != static_cast<uint64_t>(items) * (items - 1) / 2)
+      printf("MISMATCH: handoff lost or duplicated items\n");
+    return ns;
+  }
+
+  // ── stage model ────────────────────────────────────────────────────────────
+  struct Scenario
+  {
+    const char *name;
+    int encode_ms;   // encoder wait after the sensor frame
+    int send_ms;     // packetize + send
+    int stall_every; // every Nth frame sendto blocks, 0 = never
+    int stall_ms;
+  };
+
+  constexpr auto SENSOR_PERIOD = microseconds(33333);
+  constexpr auto RUN_TIME = seconds(2);
+  constexpr int FRAMES_OUT = 3; // V4L2H264Capture::MAX_FRAMES_OUT
+
+  // Next sensor frame after now, as the capture device hands them out
+  bench::Clock::time_point next_sensor_frame(bench::Clock::time_point t0)
+  {
+    auto since = bench::Clock::now() - t0;
+    auto frames = since / SENSOR_PERIOD + 1;
+    return t0 + frames * SENSOR_PERIOD;
+  }
+
+  void send_frame(const Scenario &sc, uint32_t sequence)
+  {
+    int ms = sc.send_ms;
+    if (sc.stall_every && sequence % sc.stall_every == 0)
+      ms += sc.stall_ms;
+    std::this_thread::sleep_for(milliseconds(ms));
+  }
+
+  double serial_fps(const Scenario &sc)
+  {
+    auto t0 = bench::Clock::now();
+    uint32_t frames = 0;
+    while (bench::Clock::now() - t0 < RUN_TIME)
+    {
+      std::this_thread::sleep_until(next_sensor_frame(t0));
+      std::this_thread::sleep_for(milliseconds(sc.encode_ms));
+      send_frame(sc, frames);
+      frames++;
+    }
+    return frames / duration<double>(bench::Clock::now() - t0).count();
+  }
+
+  struct PipelineResult
+  {
+    double fps;
+    uint32_t max_depth;
+    uint32_t stalls;
+  };
+
+  PipelineResult pipelined_fps(const Scenario &sc, size_t depth)
+  {
+    SPSCQueue<Handle> frames(depth);
+    SPSCQueue<Handle> released(FRAMES_OUT);
+    StreamPipelineStats stats;
+    std::atomic<bool> running{true};
+    std::atomic<uint32_t> sent{0};
+    auto t0 = bench::Clock::now();
+
+    std::thread sender([&]
+                       {
+      Handle h;
+      while (running || frames.size())
+      {
+        if (!frames.pop(h))
+        {
+          std::this_thread::sleep_for(microseconds(200));
+          continue;
+        }
+        stats.updateDepth(frames.size());
+        send_frame(sc, h.sequence);
+        sent++;
+        released.push(h);
+      } });
+
+    int out = 0;
+    bool stalled = false;
+    uint32_t sequence = 0;
+    Handle h;
+    while (bench::Clock::now() - t0 < RUN_TIME)
+    {
+      while (released.pop(h))
+        out--;
+      if (frames.full() || out >= FRAMES_OUT)
+      {
+        if (!stalled)
+          stats.stalls++;
+        stalled = true;
+        std::this_thread::sleep_for(microseconds(200));
+        continue;
+      }
+      stalled = false;
+      std::this_thread::sleep_until(next_sensor_frame(t0));
+      std::this_thread::sleep_for(milliseconds(sc.encode_ms));
+      frames.push({sequence++, out++});
+      stats.updateDepth(frames.size());
+    }
+    running = false;
+    sender.join();
+
+    double fps = sent / duration<double>(bench::Clock::now() - t0).count();
+    return {fps, stats.max_depth.load(), stats.stalls.load()};
+  }
+}
+
+int main()
+{
+  printf("SPSC handoff between two threads\n");
+  printf("%-10s %12s\n", "capacity", "ns/frame");
+  printf("%s\n", std::string(23, '-').c_str());
+  for (size_t capacity : {2, 16, 256})
+    printf("%-10zu %12.1f\n", capacity, handoff_ns(capacity, 1000000));
+
+  const Scenario scenarios[] = {
+      {"light send", 12, 8, 0, 0},
+      {"heavy send", 15, 20, 0, 0},
+      {"send stalls", 12, 10, 15, 60},
+      {"send > frame", 12, 40, 0, 0},
+  };
+
+  printf("\nSensor at 30 fps, %d frames may be out of the encoder\n", FRAMES_OUT);
+  printf("%-14s %6s %6s %8s %10s %10s %6s %7s\n",
+         "scenario", "enc ms", "send", "serial", "depth 1", "depth 2", "max", "stalls");
+  printf("%s\n", std::string(74, '-').c_str());
+  for (const auto &sc : scenarios)
+  {
+    double serial = serial_fps(sc);
+    PipelineResult one = pipelined_fps(sc, 1);
+    PipelineResult two = pipelined_fps(sc, 2);
+    printf("%-14s %6d %6d %8.1f %10.1f %10.1f %6u %7u\n",
+           sc.name, sc.encode_ms, sc.send_ms, serial, one.fps, two.fps, two.max_depth, two.stalls);
+  }
+  return 0;
+}
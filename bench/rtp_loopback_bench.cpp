@@ -0,0 +1,211 @@
+// In-process RTP round trip: RTPPacketizer (+ RTPFecEncoder) -> (loss /
+// reorder) -> RTPFecDecoder -> RTPJitterBuffer -> RTPDepacketizer, no network
+// involved
+//   rtp_loopback_bench [recorded.h264]
+
+#include "bench_common.hpp"
+#include "rtp_packetizer_mod.hpp"
+#include "rtp_depacketizer_mod.hpp"
+#include "rtp_fec_mod.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace
+{
+  struct Scenario
+  {
+    const char *name;
+    double loss;    // probability a packet is dropped
+    double reorder; // probability a packet is swapped with the next one
+    bool stap;
+    uint8_t fec_group;     // media packets per parity packet, 0 = off
+    uint8_t fec_key_group; // same for IDR frames
+  };
+
+  struct Result
+  {
+    double mb_per_s;
+    double packets_per_s;
+    double p50_us;
+    double p99_us;
+    size_t frames_out;
+    size_t frames_intact;
+    RTPJitterBuffer::Stats jitter;
+    RTPFecDecoder::Stats fec;
+  };
+
+  double percentile(std::vector<double> &v, double p)
+  {
+    if (v.empty())
+      return 0;
+    size_t i = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+  }
+
+  Result run(const bench::Stream &s, const Scenario &sc, uint16_t mtu)
+  {
+    static constexpr uint64_t FRAME_US = 33333;
+    static constexpr uint32_t JITTER_LATENCY_US = 5000;
+
+    RTPPacketizer packetizer(0x12345678, mtu);
+    packetizer.setAggregation(sc.stap);
+
+    size_t max_frame = 0;
+    for (const auto &f : s.frames)
+      max_frame = std::max(max_frame, f.size);
+    RTPDescriptorList descriptors(max_frame, mtu);
+    RTPFecEncoder fec(0x9abcdef0, mtu, max_frame);
+    fec.configure(sc.fec_group, sc.fec_key_group);
+    RTPFecDecoder fec_decoder;
+
+    RTPJitterBuffer::Config jb_config;
+    jb_config.latency_us = JITTER_LATENCY_US;
+    jb_config.mtu = mtu;
+    RTPJitterBuffer jitter(jb_config);
+    RTPDepacketizer depacketizer(max_frame * 2);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    std::vector<size_t> order;
+    std::vector<std::vector<uint8_t>> wire;
+    std::vector<double> latency_ns;
+    std::vector<bench::Clock::time_point> sent_at(s.frames.size());
+    std::vector<uint32_t> frame_ts(s.frames.size());
+
+    size_t frame_index = 0, frames_out = 0, frames_intact = 0;
+    uint64_t bytes = 0, packets = 0;
+
+    auto on_frame = [&](const RTPDepacketizer::AccessUnit &au)
+    {
+      frames_out++;
+      // Map the RTP timestamp back to the source frame
+      auto it = std::lower_bound(frame_ts.begin(), frame_ts.begin() + frame_index + 1, au.timestamp);
+      size_t index = it - frame_ts.begin();
+      if (index <= frame_index && index < s.frames.size() && frame_ts[index] == au.timestamp)
+      {
+        const bench::Frame &src = s.frames[index];
+        latency_ns.push_back(bench::elapsed_ns(sent_at[index]));
+        if (au.complete && au.size == src.size && memcmp(au.data, s.data.data() + src.offset, src.size) == 0)
+          frames_intact++;
+      }
+    };
+    auto deliver = [&](const RTPPacketInfo &info, bool discontinuity)
+    { depacketizer.push(info, discontinuity, on_frame); };
+    uint64_t arrival_us = 0;
+    auto recovered = [&](const uint8_t *data, size_t size)
+    { jitter.push(data, size, arrival_us); };
+
+    auto start = bench::Clock::now();
+    for (const auto &f : s.frames)
+    {
+      uint64_t now_us = (frame_index + 1) * FRAME_US;
+      arrival_us = now_us;
+      sent_at[frame_index] = bench::Clock::now();
+      frame_ts[frame_index] = static_cast<uint32_t>((now_us * RTP_CLOCK_RATE) / 1000000ULL);
+
+      size_t media = packetizer.packetize(s.data.data() + f.offset, f.size, now_us, descriptors);
+
+      // Serialize in send order, each parity packet after its group
+      bool keyframe = false;
+      for (const auto &d : descriptors)
+        keyframe |= d.nalType() == 5;
+      size_t parity = fec.protectFrame(descriptors, keyframe);
+      size_t count = media + parity;
+      if (wire.size() < count)
+        wire.resize(count);
+      for (size_t i = 0, p = 0, w = 0; i < media; i++)
+      {
+        const RTPPacketDescriptor &d = descriptors[i];
+        wire[w].assign(d.header, d.header + d.header_size);
+        wire[w].insert(wire[w].end(), d.payload, d.payload + d.payload_size);
+        w++;
+        for (; p < parity && fec[p].after == i; p++)
+          wire[w++].assign(fec[p].view.data, fec[p].view.data + fec[p].view.size);
+      }
+
+      order.resize(count);
+      for (size_t i = 0; i < count; i++)
+        order[i] = i;
+      for (size_t i = 0; i + 1 < count; i++)
+      {
+        if (uni(rng) < sc.reorder)
+          std::swap(order[i], order[i + 1]);
+      }
+
+      for (size_t i : order)
+      {
+        if (uni(rng) < sc.loss)
+          continue;
+        if (!fec_decoder.push(wire[i].data(), wire[i].size(), recovered))
+          jitter.push(wire[i].data(), wire[i].size(), now_us);
+        jitter.poll(now_us, deliver);
+      }
+      // Let the jitter buffer give up on this frame's gaps before the next one
+      jitter.poll(now_us + JITTER_LATENCY_US, deliver);
+
+      bytes += f.size;
+      packets += media;
+      frame_index++;
+    }
+    jitter.flush(deliver);
+    depacketizer.flush(on_frame);
+    double ns = bench::elapsed_ns(start);
+
+    Result r;
+    r.mb_per_s = (bytes / 1e6) / (ns / 1e9);
+    r.packets_per_s = packets / (ns / 1e9);
+    r.p50_us = percentile(latency_ns, 0.50) / 1e3;
+    r.p99_us = percentile(latency_ns, 0.99) / 1e3;
+    r.frames_out = frames_out;
+    r.frames_intact = frames_intact;
+    r.jitter = jitter.stats();
+    r.fec = fec_decoder.stats();
+    return r;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bench::Stream s = bench::load_or_synth(argc, argv);
+
+  const Scenario scenarios[] = {
+      {"clean", 0.0, 0.0, false, 0, 0},
+      {"clean stap", 0.0, 0.0, true, 0, 0},
+      {"clean fec 10/4", 0.0, 0.0, false, 10, 4},
+      {"reorder 2%", 0.0, 0.02, false, 0, 0},
+      {"loss 0.5%", 0.005, 0.0, false, 0, 0},
+      {"loss 0.5% fec 10/4", 0.005, 0.0, false, 10, 4},
+      {"loss 2% reorder 2%", 0.02, 0.02, false, 0, 0},
+      {"loss 2% fec 5/2", 0.02, 0.02, false, 5, 2},
+  };
+
+  printf("%-20s %9s %12s %9s %9s %7s %7s %6s %6s %6s %6s\n",
+         "scenario", "MB/s", "packets/s", "p50 us", "p99 us", "frames", "intact", "lost", "reord", "late", "fixed");
+  printf("%s\n", std::string(105, '-').c_str());
+
+  int failures = 0;
+  for (const auto &sc : scenarios)
+  {
+    Result r = run(s, sc, RTP_DEFAULT_MTU);
+    printf("%-20s %9.1f %12.0f %9.1f %9.1f %7zu %7zu %6llu %6llu %6llu %6llu\n",
+           sc.name, r.mb_per_s, r.packets_per_s, r.p50_us, r.p99_us, r.frames_out, r.frames_intact,
+           static_cast<unsigned long long>(r.jitter.lost),
+           static_cast<unsigned long long>(r.jitter.reordered),
+           static_cast<unsigned long long>(r.jitter.late),
+           static_cast<unsigned long long>(r.fec.recovered));
+
+    // Without loss every frame must come back bit exact, with loss FEC must
+    // have rebuilt something
+    if (sc.loss == 0.0 && r.frames_intact != s.frames.size())
+      failures++;
+    if (sc.loss > 0.0 && sc.fec_group > 0 && r.fec.recovered == 0)
+      failures++;
+  }
+
+  if (failures)
+    printf("MISMATCH: lossless round trip did not reproduce every frame or FEC recovered nothing\n");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+// RTP packetization benchmark: every RTPPacketizer output mode over streams
+// with different NAL sizes, IDR ratios and MTUs. The descriptor modes run the
+// compile-time specialized path where the MTU has one (1200, 1400) and are
+// repeated with the runtime layout ("-rt") for comparison. RTP/JPEG rows
+// measure packetizer cost only; the synthetic frame sizes say nothing about
+// either codec, compare those with the device's once-per-second log line.
+//   rtp_packetizer_bench [recorded.h264]
+
+#include "bench_common.hpp"
+#include "rtp_packetizer_mod.hpp"
+#include "rtp_jpeg_mod.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// ── allocation counting ─────────────────────────────────────────────────────
+static std::atomic<uint64_t> g_allocations{0};
+
+void *operator new(size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace
+{
+  enum class Mode
+  {
+    Vector,
+    Arena,
+    Descriptors,
+    DescriptorsStap,
+    DescriptorsRuntime,     // specialization disabled
+    DescriptorsStapRuntime, // specialization disabled
+    Stream, // incremental feed() in encoder-buffer sized chunks
+    Jpeg,   // RFC 2435, JPEG input
+  };
+
+  constexpr size_t STREAM_CHUNK = 4096;
+
+  const char *mode_name(Mode m)
+  {
+    switch (m)
+    {
+    case Mode::Vector:
+      return "vector";
+    case Mode::Arena:
+      return "arena";
+    case Mode::Descriptors:
+      return "desc";
+    case Mode::DescriptorsStap:
+      return "desc+stap";
+    case Mode::DescriptorsRuntime:
+      return "desc-rt";
+    case Mode::DescriptorsStapRuntime:
+      return "desc+stap-rt";
+    case Mode::Stream:
+      return "stream";
+    case Mode::Jpeg:
+      return "jpeg";
+    }
+    return "?";
+  }
+
+  struct Result
+  {
+    double packets_per_s;
+    double ns_per_byte;
+    double allocs_per_frame;
+    double p50_us;
+    double p99_us;
+    double max_us;
+  };
+
+  double percentile(std::vector<double> &v, double p)
+  {
+    size_t i = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+  }
+
+  Result run(const bench::Stream &s, Mode mode, uint16_t mtu, int passes)
+  {
+    RTPPacketizer packetizer(0x12345678, mtu);
+    RTPJpegPacketizer jpeg(0x12345678, mtu);
+    packetizer.setAggregation(mode == Mode::DescriptorsStap || mode == Mode::DescriptorsStapRuntime);
+    packetizer.setSpecialization(mode != Mode::DescriptorsRuntime && mode != Mode::DescriptorsStapRuntime);
+
+    size_t max_frame = 0;
+    for (const auto &f : s.frames)
+      max_frame = std::max(max_frame, f.size);
+    RTPPacketArena arena(max_frame, mtu);
+    RTPDescriptorList descriptors(max_frame, mtu);
+
+    std::vector<double> frame_ns;
+    frame_ns.reserve(s.frames.size() * passes);
+
+    uint64_t packets = 0, bytes = 0, allocs = 0, sink = 0;
+    auto on_packet = [&sink](const uint8_t *packet, size_t size)
+    { sink += packet[size - 1] + size; };
+    if (mode == Mode::Stream)
+      packetizer.beginAccessUnit(0); // sizes the streaming buffers once
+    uint64_t ts_us = 0;
+    double total_ns = 0;
+
+    for (int pass = 0; pass < passes; pass++)
+    {
+      for (const auto &f : s.frames)
+      {
+        const uint8_t *data = s.data.data() + f.offset;
+        ts_us += 33333;
+
+        uint64_t allocs_before = g_allocations.load(std::memory_order_relaxed);
+        auto start = bench::Clock::now();
+
+        size_t count = 0;
+        switch (mode)
+        {
+        case Mode::Vector:
+          count = packetizer.packetize(data, f.size, ts_us).size();
+          break;
+        case Mode::Arena:
+          count = packetizer.packetize(data, f.size, ts_us, arena);
+          allocs += arena.frameAllocations();
+          break;
+        case Mode::Descriptors:
+        case Mode::DescriptorsStap:
+        case Mode::DescriptorsRuntime:
+        case Mode::DescriptorsStapRuntime:
+          count = packetizer.packetize(data, f.size, ts_us, descriptors);
+          allocs += descriptors.frameAllocations();
+          break;
+        case Mode::Stream:
+          packetizer.beginAccessUnit(ts_us);
+          for (size_t off = 0; off < f.size; off += STREAM_CHUNK)
+            packetizer.feed(data + off, std::min(STREAM_CHUNK, f.size - off), on_packet);
+          count = packetizer.endAccessUnit(on_packet);
+          break;
+        case Mode::Jpeg:
+          count = jpeg.packetize(data, f.size, ts_us, descriptors);
+          allocs += descriptors.frameAllocations();
+          break;
+        }
+
+        double ns = bench::elapsed_ns(start);
+        allocs += g_allocations.load(std::memory_order_relaxed) - allocs_before;
+
+        frame_ns.push_back(ns);
+        total_ns += ns;
+        packets += count;
+        bytes += f.size;
+      }
+    }
+
+    if (sink == 1)
+      printf("\n"); // keeps the stream sink observable
+
+    Result r;
+    r.packets_per_s = packets / (total_ns / 1e9);
+    r.ns_per_byte = total_ns / bytes;
+    r.allocs_per_frame = static_cast<double>(allocs) / frame_ns.size();
+    r.p50_us = percentile(frame_ns, 0.50) / 1e3;
+    r.p99_us = percentile(frame_ns, 0.99) / 1e3;
+    r.max_us = *std::max_element(frame_ns.begin(), frame_ns.end()) / 1e3;
+    return r;
+  }
+
+  void report(const std::string &scenario, const bench::Stream &s, uint16_t mtu, int passes)
+  {
+    for (Mode mode : {Mode::Vector, Mode::Arena, Mode::Descriptors, Mode::DescriptorsRuntime,
+                      Mode::DescriptorsStap, Mode::DescriptorsStapRuntime, Mode::Stream})
+    {
+      Result r = run(s, mode, mtu, passes);
+      printf("%-22s %5u %-12s %12.0f %8.3f %8.2f %9.1f %9.1f %9.1f\n",
+             scenario.c_str(), mtu, mode_name(mode), r.packets_per_s, r.ns_per_byte,
+             r.allocs_per_frame, r.p50_us, r.p99_us, r.max_us);
+    }
+  }
+
+  void report_jpeg(const std::string &scenario, const bench::Stream &s, uint16_t mtu, int passes)
+  {
+    Result r = run(s, Mode::Jpeg, mtu, passes);
+    printf("%-22s %5u %-12s %12.0f %8.3f %8.2f %9.1f %9.1f %9.1f\n",
+           scenario.c_str(), mtu, mode_name(Mode::Jpeg), r.packets_per_s, r.ns_per_byte,
+           r.allocs_per_frame, r.p50_us, r.p99_us, r.max_us);
+  }
+
+  void header()
+  {
+    printf("%-22s %5s %-12s %12s %8s %8s %9s %9s %9s\n",
+           "scenario", "mtu", "mode", "packets/s", "ns/byte", "alloc/fr", "p50 us", "p99 us", "max us");
+    printf("%s\n", std::string(102, '-').c_str());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const int passes = 5;
+  header();
+
+  if (argc > 1)
+  {
+    bench::Stream s;
+    if (!bench::load_stream(argv[1], s))
+    {
+      fprintf(stderr, "Failed to load %s\n", argv[1]);
+      return 1;
+    }
+    for (uint16_t mtu : {576, 1200, 1400})
+      report("recorded", s, mtu, passes);
+    return 0;
+  }
+
+  // MTU sweep on the default stream (1280x960, GOP 30)
+  bench::SynthConfig base;
+  bench::Stream s = bench::synth_stream(base);
+  for (uint16_t mtu : {576, 1200, 1400})
+    report("gop30", s, mtu, passes);
+
+  // IDR ratio
+  for (int period : {1, 10})
+  {
+    bench::SynthConfig cfg = base;
+    cfg.idr_period = period;
+    report("gop" + std::to_string(period), bench::synth_stream(cfg), RTP_DEFAULT_MTU, passes);
+  }
+
+  // NAL sizes: multi-slice pictures and low bitrate frames
+  {
+    bench::SynthConfig cfg = base;
+    cfg.slices = 8;
+    report("gop30 8 slices", bench::synth_stream(cfg), RTP_DEFAULT_MTU, passes);
+  }
+  {
+    bench::SynthConfig cfg = base;
+    cfg.idr_bytes = 8000;
+    cfg.p_bytes = 600;
+    cfg.slices = 4;
+    report("gop30 small NALs", bench::synth_stream(cfg), RTP_DEFAULT_MTU, passes);
+  }
+
+  // RTP/JPEG at the same resolution, ~110 KB per frame is typical for q80
+  bench::Stream jpeg = bench::synth_jpeg_stream(300, 1280, 960, 110000);
+  for (uint16_t mtu : {576, 1200, 1400})
+    report_jpeg("jpeg 1280x960", jpeg, mtu, passes);
+  report_jpeg("jpeg restart markers", bench::synth_jpeg_stream(300, 1280, 960, 110000, 40), RTP_DEFAULT_MTU, passes);
+
+  return 0;
+}
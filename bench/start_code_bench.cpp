@@ -0,0 +1,164 @@
+// Annex B start-code scanner throughput: RTPPacketizer's memchr scan vs a
+// bytewise loop and a word-at-a-time candidate. The word scan loses to glibc's
+// vectorized memchr on the host; it only belongs in the firmware if device
+// numbers show it ahead of the target libc's memchr.
+//   start_code_bench [recorded.h264]
+
+#include "bench_common.hpp"
+#include "rtp_packetizer_mod.hpp"
+
+#include <cstring>
+
+namespace
+{
+  using ScanFn = const uint8_t *(*)(const uint8_t *, const uint8_t *, uint8_t &);
+
+  // Same search with a plain byte loop in place of memchr, which is close to
+  // what the size-optimized libc on the target does
+  const uint8_t *find_start_code_bytewise(const uint8_t *p, const uint8_t *end, uint8_t &sc_len)
+  {
+    for (; p + 3 <= end; ++p)
+    {
+      if (p[0] != 0x00 || p[1] != 0x00)
+        continue;
+      if (p[2] == 0x01)
+      {
+        sc_len = 3;
+        return p;
+      }
+      if (p[2] == 0x00 && p + 4 <= end && p[3] == 0x01)
+      {
+        sc_len = 4;
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  // p[0] is known to be zero
+  bool is_start_code(const uint8_t *p, const uint8_t *end, uint8_t &sc_len)
+  {
+    if (p[1] != 0x00)
+      return false;
+    if (p[2] == 0x01)
+    {
+      sc_len = 3;
+      return true;
+    }
+    if (p[2] == 0x00 && p + 4 <= end && p[3] == 0x01)
+    {
+      sc_len = 4;
+      return true;
+    }
+    return false;
+  }
+
+  // Non-zero if w may hold two adjacent zero bytes (in memory order). OR-ing
+  // each byte with its successor turns a zero pair into a zero byte; the last
+  // byte has no successor in w, so a trailing zero byte is also reported and
+  // settled by the byte check.
+  uintptr_t zero_pair_mask(uintptr_t w)
+  {
+    static constexpr uintptr_t ONES = ~uintptr_t(0) / 0xFF;
+    static constexpr uintptr_t HIGHS = ONES * 0x80;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uintptr_t v = w | (w >> 8);
+#else
+    uintptr_t v = w | (w << 8);
+#endif
+    return (v - ONES) & ~v & HIGHS;
+  }
+
+  // Loads two machine words per step and only inspects bytes around zero
+  // pairs, which are rare in entropy-coded slice data
+  const uint8_t *find_start_code_word(const uint8_t *p, const uint8_t *end, uint8_t &sc_len)
+  {
+    using Word = uintptr_t; // 4 bytes on the ESP32-P4, 8 on 64-bit hosts
+    static constexpr size_t W = sizeof(Word);
+
+    while (p + 3 <= end && (reinterpret_cast<uintptr_t>(p) & (W - 1)))
+    {
+      if (*p == 0x00 && is_start_code(p, end, sc_len))
+        return p;
+      ++p;
+    }
+
+    while (p + 2 * W + 3 <= end)
+    {
+      Word w0, w1;
+      memcpy(&w0, p, W);
+      memcpy(&w1, p + W, W);
+      if (zero_pair_mask(w0) | zero_pair_mask(w1))
+      {
+        for (size_t i = 0; i < 2 * W; i++)
+        {
+          if (p[i] == 0x00 && is_start_code(p + i, end, sc_len))
+            return p + i;
+        }
+      }
+      p += 2 * W;
+    }
+
+    for (; p + 3 <= end; ++p)
+    {
+      if (*p == 0x00 && is_start_code(p, end, sc_len))
+        return p;
+    }
+    return nullptr;
+  }
+
+  // Walks the buffer the way processNALUnits does, returns a position checksum
+  uint64_t scan(ScanFn fn, const uint8_t *data, size_t size, size_t &count)
+  {
+    const uint8_t *end = data + size;
+    const uint8_t *p = data;
+    uint8_t sc_len = 0;
+    uint64_t sum = 0;
+    count = 0;
+
+    while ((p = fn(p, end, sc_len)) != nullptr)
+    {
+      sum += static_cast<uint64_t>(p - data) * sc_len;
+      count++;
+      p += sc_len + 1;
+    }
+    return sum;
+  }
+
+  double run(const char *name, ScanFn fn, const bench::Stream &s, int iterations, uint64_t &checksum)
+  {
+    size_t count = 0;
+    checksum = scan(fn, s.data.data(), s.data.size(), count); // warm-up
+
+    auto start = bench::Clock::now();
+    for (int i = 0; i < iterations; i++)
+      scan(fn, s.data.data(), s.data.size(), count);
+    double ns = bench::elapsed_ns(start);
+
+    double mb_s = (static_cast<double>(s.data.size()) * iterations / 1e6) / (ns / 1e9);
+    printf("  %-10s %9.1f MB/s  %6.3f ns/byte  (%zu start codes)\n",
+           name, mb_s, ns / (static_cast<double>(s.data.size()) * iterations), count);
+    return mb_s;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bench::Stream s = bench::load_or_synth(argc, argv);
+  const int iterations = static_cast<int>(std::max<size_t>(1, (512u << 20) / std::max<size_t>(s.data.size(), 1)));
+
+  uint64_t ref = 0, bytewise = 0, word = 0;
+  double memchr_mb_s = run("memchr", RTPPacketizer::findStartCode, s, iterations, ref);
+  double bytewise_mb_s = run("bytewise", find_start_code_bytewise, s, iterations, bytewise);
+  double word_mb_s = run("word", find_start_code_word, s, iterations, word);
+
+  if (ref != bytewise || ref != word)
+  {
+    printf("MISMATCH: scanners disagree on start code positions\n");
+    return 1;
+  }
+
+  printf("  word vs memchr   %6.2fx\n", word_mb_s / memchr_mb_s);
+  printf("  word vs bytewise %6.2fx\n", word_mb_s / bytewise_mb_s);
+  return 0;
+}
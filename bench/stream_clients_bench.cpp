@@ -0,0 +1,84 @@
+// Viewer table as the data task uses it: per-frame snapshot() plus the
+// per-viewer state lookup for a full table, and a check that state kept in
+// StreamSlotState starts over when a stopped viewer's slot goes to a new one.
+//   stream_clients_bench
+
+#include "bench_common.hpp"
+#include "stream_clients_mod.hpp"
+
+#include <string>
+
+namespace
+{
+  struct ViewerState
+  {
+    bool waiting_for_idr;
+    uint32_t skipped_at_report;
+  };
+
+  struct sockaddr_in viewer(uint16_t port)
+  {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0xC0A80100u + 20); // 192.168.1.20
+    addr.sin_port = htons(port);
+    return addr;
+  }
+
+  // A viewer that stopped while waiting for an IDR hands its slot to the next
+  // start; the newcomer must not inherit any of that state
+  int check_slot_reuse()
+  {
+    StreamClientTable table(STREAM_MAX_CLIENTS);
+    StreamSlotState<ViewerState> state;
+    int failures = 0;
+
+    bool added = false;
+    int first = table.add(viewer(3333), added);
+    ViewerState &old_state = state.get(table, static_cast<uint8_t>(first));
+    old_state.waiting_for_idr = true;
+    old_state.skipped_at_report = 7;
+
+    // start again from the same viewer keeps its entry and its state
+    table.add(viewer(3333), added);
+    failures += !state.get(table, static_cast<uint8_t>(first)).waiting_for_idr;
+
+    table.remove(viewer(3333));
+    int second = table.add(viewer(4444), added);
+    const ViewerState &new_state = state.get(table, static_cast<uint8_t>(second));
+    failures += second != first;
+    failures += new_state.waiting_for_idr || new_state.skipped_at_report != 0;
+
+    printf("slot reuse: stop then start on slot %d %s\n", second, failures ? "KEPT STALE STATE" : "starts clean");
+    return failures;
+  }
+
+  void snapshot_cost(int frames)
+  {
+    StreamClientTable table(STREAM_MAX_CLIENTS);
+    StreamSlotState<ViewerState> state;
+    bool added = false;
+    for (uint16_t i = 0; i < STREAM_MAX_CLIENTS; i++)
+      table.add(viewer(static_cast<uint16_t>(5000 + 2 * i)), added);
+
+    StreamClientTable::Destination viewers[STREAM_MAX_CLIENTS + 1];
+    uint64_t sink = 0;
+    auto start = bench::Clock::now();
+    for (int f = 0; f < frames; f++)
+    {
+      size_t count = table.snapshot(viewers);
+      for (size_t c = 0; c < count; c++)
+        sink += state.get(table, viewers[c].index).waiting_for_idr + viewers[c].addr.sin_port;
+    }
+    double ns = bench::elapsed_ns(start);
+    printf("snapshot + state lookup, %zu viewers: %.1f ns/frame (%llu)\n", STREAM_MAX_CLIENTS, ns / frames,
+           static_cast<unsigned long long>(sink % 10));
+  }
+}
+
+int main()
+{
+  int failures = check_slot_reuse();
+  snapshot_cost(1000000);
+  return failures ? 1 : 0;
+}
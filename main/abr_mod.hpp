@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+// Defined outside the class to avoid initialization order issues
+struct AbrConfig
+{
+  bool enabled = true;
+  uint32_t floor_bps = 2000000;
+  uint32_t ceiling_bps = 25000000; // also the starting bitrate
+  uint32_t interval_ms = 500;
+
+  // Congested if any signal is above its high mark over an interval...
+  float loss_high = 0.05f;        // worst RTCP fraction lost
+  float drop_high = 0.02f;        // TX queue drops per packet sent
+  uint32_t rtt_rise_us = 60000;   // RTT above the lowest seen this session
+  uint32_t backlog_high = 100;    // frame send time, percent of the frame interval
+  uint32_t stalls_high = 2;       // capture waited for the send stage
+  // ...clean if all are below their low mark, anything in between holds
+  float loss_low = 0.01f;
+  float drop_low = 0.002f;
+  uint32_t backlog_low = 70;
+
+  uint8_t decrease_percent = 20; // of the current bitrate per cut
+  uint8_t increase_percent = 5;  // of the ceiling per step up
+  uint32_t decrease_gap_ms = 1000; // RTCP reports lag, let a cut take effect
+  uint32_t hold_ms = 5000;         // clean time after congestion before the first step up
+  uint32_t step_ms = 1000;         // between further steps up while clean
+
+  // The encoder's max QP moves from its configured value towards this limit
+  // as the bitrate goes from the ceiling to the floor
+  int max_qp_limit = 51;
+};
+
+// Congestion signals over one interval, gathered by the streamer
+struct AbrSignals
+{
+  uint32_t packets = 0; // sent over all viewers
+  uint32_t drops = 0;   // of those, refused by a full TX queue
+  float loss = 0;       // worst fresh RTCP fraction lost
+  uint32_t rtt_us = 0;  // worst fresh RTCP round trip, 0 if none
+  uint32_t backlog = 0; // percent of the frame interval the last frame took to send
+  uint32_t stalls = 0;  // capture waited for the send stage
+
+  float dropRate() const { return packets ? static_cast<float>(drops) / packets : 0.0f; }
+};
+
+enum class AbrReason : uint8_t
+{
+  Loss,
+  Drops,
+  Rtt,
+  Backlog,
+  Clean,
+  Limits, // floor or ceiling changed
+};
+
+inline const char *abrReasonName(AbrReason reason)
+{
+  switch (reason)
+  {
+  case AbrReason::Loss:
+    return "loss";
+  case AbrReason::Drops:
+    return "tx drops";
+  case AbrReason::Rtt:
+    return "rtt";
+  case AbrReason::Backlog:
+    return "backlog";
+  case AbrReason::Clean:
+    return "clean";
+  case AbrReason::Limits:
+    return "limits";
+  }
+  return "";
+}
+
+// One bitrate change and the signals behind it
+struct AbrDecision
+{
+  uint32_t time_ms = 0;
+  uint32_t from_bps = 0;
+  uint32_t to_bps = 0;
+  int max_qp = 0;
+  AbrReason reason = AbrReason::Clean;
+  AbrSignals signals;
+};
+
+// AIMD rate control for the encoder: a congested interval cuts the bitrate
+// by decrease_percent, a run of clean intervals raises it by
+// increase_percent of the ceiling, always within [floor, ceiling]. The gap
+// between the high and low marks plus the hold time keep it from
+// oscillating around a marginal link. The last LOG_SIZE changes are kept so
+// a quality drop can be traced to its cause afterwards.
+// update() runs on the ABR task, the rest may be called from the control task.
+class AbrController
+{
+public:
+  static constexpr size_t LOG_SIZE = 8;
+
+  explicit AbrController(const AbrConfig &config = AbrConfig()) : config_(config)
+  {
+    bitrate_ = config_.ceiling_bps;
+  }
+
+  // New stream: start from start_bps and forget the RTT baseline.
+  // base_max_qp is the encoder's max QP at the ceiling.
+  void reset(uint32_t start_bps, int base_max_qp)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bitrate_ = std::clamp(start_bps, config_.floor_bps, config_.ceiling_bps);
+    base_max_qp_ = base_max_qp;
+    min_rtt_us_ = 0;
+    last_decrease_ms_ = 0;
+    clean_since_ms_ = 0;
+    last_increase_ms_ = 0;
+    started_ = false;
+  }
+
+  // Returns true with decision filled in when the bitrate changes
+  bool update(const AbrSignals &s, uint32_t now_ms, AbrDecision &decision)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!started_)
+    {
+      started_ = true;
+      clean_since_ms_ = now_ms;
+      last_increase_ms_ = now_ms;
+    }
+    if (s.rtt_us > 0 && (min_rtt_us_ == 0 || s.rtt_us < min_rtt_us_))
+      min_rtt_us_ = s.rtt_us;
+
+    uint32_t rtt_rise = s.rtt_us > min_rtt_us_ ? s.rtt_us - min_rtt_us_ : 0;
+    float drop_rate = s.dropRate();
+
+    // Most specific cause first: RTCP loss is what the viewer sees
+    bool congested = true;
+    AbrReason reason;
+    if (s.loss > config_.loss_high)
+      reason = AbrReason::Loss;
+    else if (drop_rate > config_.drop_high)
+      reason = AbrReason::Drops;
+    else if (s.backlog > config_.backlog_high || s.stalls >= config_.stalls_high)
+      reason = AbrReason::Backlog;
+    else if (config_.rtt_rise_us > 0 && rtt_rise > config_.rtt_rise_us)
+      reason = AbrReason::Rtt;
+    else
+    {
+      congested = false;
+      reason = AbrReason::Clean;
+    }
+
+    bool clean = !congested && s.loss <= config_.loss_low && drop_rate <= config_.drop_low &&
+                 s.backlog <= config_.backlog_low && s.stalls == 0 && rtt_rise <= config_.rtt_rise_us / 2;
+
+    uint32_t target = bitrate_;
+    if (congested)
+    {
+      clean_since_ms_ = now_ms;
+      if (now_ms - last_decrease_ms_ >= config_.decrease_gap_ms || last_decrease_ms_ == 0)
+      {
+        target = static_cast<uint32_t>(static_cast<uint64_t>(bitrate_) * (100 - config_.decrease_percent) / 100);
+        last_decrease_ms_ = now_ms;
+      }
+    }
+    else if (!clean)
+    {
+      clean_since_ms_ = now_ms;
+    }
+    else if (now_ms - clean_since_ms_ >= config_.hold_ms && now_ms - last_increase_ms_ >= config_.step_ms)
+    {
+      target = bitrate_ + static_cast<uint32_t>(static_cast<uint64_t>(config_.ceiling_bps) * config_.increase_percent / 100);
+      last_increase_ms_ = now_ms;
+    }
+
+    uint32_t clamped = std::clamp(target, config_.floor_bps, config_.ceiling_bps);
+    if (clamped == bitrate_)
+      return false;
+    if (target == bitrate_)
+      reason = AbrReason::Limits;
+
+    decision.time_ms = now_ms;
+    decision.from_bps = bitrate_;
+    decision.to_bps = clamped;
+    decision.reason = reason;
+    decision.signals = s;
+    bitrate_ = clamped;
+    decision.max_qp = maxQpLocked();
+
+    log_[log_next_] = decision;
+    log_next_ = (log_next_ + 1) % LOG_SIZE;
+    log_count_ = std::min(log_count_ + 1, LOG_SIZE);
+    return true;
+  }
+
+  // Limits take effect at the next update(); false if floor > ceiling
+  bool configure(uint32_t floor_bps, uint32_t ceiling_bps, uint32_t hold_ms)
+  {
+    if (floor_bps == 0 || floor_bps > ceiling_bps)
+      return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_.floor_bps = floor_bps;
+    config_.ceiling_bps = ceiling_bps;
+    config_.hold_ms = hold_ms;
+    return true;
+  }
+
+  void setEnabled(bool enabled)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_.enabled = enabled;
+  }
+
+  AbrConfig config() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_;
+  }
+
+  uint32_t bitrate() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bitrate_;
+  }
+
+  int maxQp() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return maxQpLocked();
+  }
+
+  // Copies up to max decisions, newest first; returns how many
+  size_t history(AbrDecision *out, size_t max) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = std::min(max, log_count_);
+    for (size_t i = 0; i < n; i++)
+      out[i] = log_[(log_next_ + LOG_SIZE - 1 - i) % LOG_SIZE];
+    return n;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  AbrConfig config_;
+  uint32_t bitrate_ = 0;
+  int base_max_qp_ = 45;
+  uint32_t min_rtt_us_ = 0;
+  uint32_t last_decrease_ms_ = 0;
+  uint32_t clean_since_ms_ = 0;
+  uint32_t last_increase_ms_ = 0;
+  bool started_ = false;
+
+  AbrDecision log_[LOG_SIZE];
+  size_t log_next_ = 0;
+  size_t log_count_ = 0;
+
+  int maxQpLocked() const
+  {
+    int limit = std::max(config_.max_qp_limit, base_max_qp_);
+    uint32_t span = config_.ceiling_bps - config_.floor_bps;
+    if (span == 0 || bitrate_ >= config_.ceiling_bps)
+      return base_max_qp_;
+    uint32_t below = config_.ceiling_bps - std::max(bitrate_, config_.floor_bps);
+    return base_max_qp_ + static_cast<int>(static_cast<uint64_t>(limit - base_max_qp_) * below / span);
+  }
+};
@@ -8,6 +8,17 @@
 #include "wifi_mod.hpp"
 #include "video_mod.hpp"
 #include "music_mod.hpp"
+#include "rtp_packetizer_mod.hpp"
+#include "rtp_jpeg_mod.hpp"
+#include "rtp_pacer_mod.hpp"
+#include "rtp_fec_mod.hpp"
+#include "rtcp_mod.hpp"
+#include "stream_clients_mod.hpp"
+#include "stream_pipeline_mod.hpp"
+#include "sdp_mod.hpp"
+#include "udp_transport_mod.hpp"
+#include "abr_mod.hpp"
+#include "latency_histogram_mod.hpp"
 #include <atomic>
 #include <cstdlib>
 #include <functional>
@@ -23,9 +34,24 @@ public:
   struct Context
   {
     std::atomic<bool> *stream_active;
-    struct sockaddr_in *video_client_addr;
+    StreamClientTable *clients;
     struct sockaddr_in *source_addr;
     V4L2H264Capture *capture;
+    RTPPacketizer *packetizer;
+    RTPJpegPacketizer *jpeg_packetizer;
+    PacketPacer *pacer;
+    RTPFecEncoder *fec;
+    // Queues a retransmission to the viewer at source, null if disabled
+    void (*nack)(const struct sockaddr_in &source, uint16_t seq);
+    const RTCPSession *rtcp;
+    std::atomic<bool> *resend_parameter_sets;
+    const StreamPipelineStats *pipeline;
+    // Send backend the data task switches to, true for the lwIP raw API
+    std::atomic<bool> *raw_transport;
+    AbrController *abr;
+    KeyframeRequestLimiter *keyframes;
+    PipelineLatency *latency;
+    const StreamReportCounters *report;
   };
 
   struct Result
@@ -57,8 +83,20 @@ public:
   {
     if (strcmp(cmd, "info") == 0)
       return handleInfo(ctx);
-    if (strcmp(cmd, "start") == 0)
-      handleStart(ctx);
+    if (strcmp(cmd, "sdp") == 0)
+      return handleSdp(ctx);
+    if (strncmp(cmd, "netbench", 8) == 0)
+      return handleNetbench(cmd, ctx);
+    if (strcmp(cmd, "abr") == 0)
+      return handleAbrStatus(ctx);
+    if (strncmp(cmd, "latency", 7) == 0)
+      return handleLatency(cmd, ctx);
+    if (strcmp(cmd, "report") == 0)
+      return handleReport(ctx);
+    if (strncmp(cmd, "start", 5) == 0)
+      handleStart(cmd, ctx);
+    else if (strncmp(cmd, "stream:::", 9) == 0)
+      handleStream(cmd, ctx);
     else if (strcmp(cmd, "stop") == 0)
       handleStop(ctx);
     else if (strcmp(cmd, "reboot") == 0)
@@ -69,6 +107,20 @@ public:
       handleWifiSTA(cmd, ctx);
     else if (strncmp(cmd, "camera", 6) == 0)
       handleCamera(cmd, ctx);
+    else if (strncmp(cmd, "pacing", 6) == 0)
+      handlePacing(cmd, ctx);
+    else if (strncmp(cmd, "fec", 3) == 0)
+      handleFec(cmd, ctx);
+    else if (strncmp(cmd, "nack", 4) == 0)
+      handleNack(cmd, ctx);
+    else if (strncmp(cmd, "multicast", 9) == 0)
+      handleMulticast(cmd, ctx);
+    else if (strncmp(cmd, "transport", 9) == 0)
+      handleTransport(cmd, ctx);
+    else if (strncmp(cmd, "abr:::", 6) == 0)
+      handleAbr(cmd, ctx);
+    else if (strncmp(cmd, "keyframe", 8) == 0)
+      handleKeyframe(cmd, ctx);
     else if (strcmp(cmd, "clear_error") == 0)
       handleClearError(ctx);
     else if (strcmp(cmd, "music_stop") == 0)
@@ -86,20 +138,105 @@ public:
 private:
   static constexpr const char *TAG = "CMD_PROC";
   temperature_sensor_handle_t temp_sensor_ = nullptr;
-  char info_buffer_[512] = {};
+  char info_buffer_[4096] = {};
   std::string last_error_;
   MusicPlayerMod music_player_;
 
-  void handleStart(const Context &ctx)
+  void handleStart(const char *cmd, const Context &ctx)
   {
-    vTaskDelay(pdMS_TO_TICKS(100));
-    *ctx.video_client_addr = *ctx.source_addr;
+    // All viewers share one stream: a joining viewer gets the current
+    // settings, options may only differ from them while nobody else watches
+    int stap = -1, ext = -1, jpeg = -1;
+    parseStartParams(cmd, stap, ext, jpeg);
+
+    // Joins the viewer table; a viewer sending start again keeps its entry
+    bool added = false;
+    if (ctx.clients->add(*ctx.source_addr, added) < 0)
+    {
+      last_error_ = "viewer limit reached, stop a viewer first";
+      return;
+    }
+
+    if (ctx.clients->size() > 1 && conflictsWithStream(ctx, stap, ext, jpeg))
+    {
+      if (added)
+        ctx.clients->remove(*ctx.source_addr);
+      last_error_ = "start options differ from the shared stream, change them with stream:::stap:0|1:::ext:0|1:::jpeg:0|1";
+      return;
+    }
+
+    applyStreamSettings(ctx, stap, ext, jpeg);
+    // New viewer: send the cached SPS/PPS with the next frame and ask for
+    // an IDR instead of leaving it black until the next scheduled one
+    if (added && ctx.resend_parameter_sets)
+      ctx.resend_parameter_sets->store(true);
+    if (added && ctx.keyframes)
+      ctx.keyframes->request();
     ctx.stream_active->store(true);
   }
 
+  // stream:::stap:1:::ext:1:::jpeg:1 changes the shared stream settings for
+  // every viewer; options left out keep their current value
+  void handleStream(const char *cmd, const Context &ctx)
+  {
+    int stap = -1, ext = -1, jpeg = -1;
+    parseStartParams(cmd, stap, ext, jpeg);
+    if (stap < 0 && ext < 0 && jpeg < 0)
+    {
+      last_error_ = "no valid parameters. Use: stream:::stap:0|1:::ext:0|1:::jpeg:0|1";
+      return;
+    }
+
+    bool active = ctx.stream_active->load();
+    applyStreamSettings(ctx, stap, ext, jpeg);
+    ctx.stream_active->store(active);
+  }
+
+  bool conflictsWithStream(const Context &ctx, int stap, int ext, int jpeg) const
+  {
+    bool is_jpeg = ctx.capture && ctx.capture->getConfig().codec == V4L2H264Capture::Codec::JPEG;
+    if (jpeg >= 0 && (jpeg > 0) != is_jpeg)
+      return true;
+    if (ctx.packetizer && stap >= 0 && (stap > 0) != ctx.packetizer->aggregation())
+      return true;
+    return ctx.packetizer && ext >= 0 && (ext > 0) != ctx.packetizer->headerExtensions();
+  }
+
+  // Options below 0 keep the current value
+  void applyStreamSettings(const Context &ctx, int stap, int ext, int jpeg)
+  {
+    // Switching codecs restarts the capture pipeline on the other encoder
+    if (ctx.capture && jpeg >= 0)
+    {
+      auto codec = jpeg > 0 ? V4L2H264Capture::Codec::JPEG : V4L2H264Capture::Codec::H264;
+      if (ctx.capture->getConfig().codec != codec)
+      {
+        ctx.stream_active->store(false);
+        V4L2H264Capture::Config config = ctx.capture->getConfig();
+        config.codec = codec;
+        ctx.capture->updateConfig(config);
+      }
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(100));
+    if (ctx.packetizer && stap >= 0)
+      ctx.packetizer->setAggregation(stap > 0);
+    if (ctx.packetizer && ext >= 0)
+      ctx.packetizer->setHeaderExtensions(ext > 0);
+    if (ctx.jpeg_packetizer && ext >= 0)
+      ctx.jpeg_packetizer->setHeaderExtensions(ext > 0);
+  }
+
+  // A viewer leaves; the stream stops with the last one
   void handleStop(const Context &ctx)
   {
-    ctx.stream_active->store(false);
+    if (!ctx.clients->remove(*ctx.source_addr))
+    {
+      last_error_ = "stop from an address that is not a viewer";
+      return;
+    }
+    if (ctx.clients->size() == 0)
+      ctx.stream_active->store(false);
   }
 
   void handleReboot(const Context &ctx)
@@ -174,6 +311,389 @@ private:
     ctx.stream_active->store(true);
   }
 
+  void handlePacing(const char *cmd, const Context &ctx)
+  {
+    if (!ctx.pacer)
+    {
+      last_error_ = "pacer not available";
+      return;
+    }
+
+    int window = -1, burst = -1;
+    parsePacingParams(cmd, window, burst);
+
+    if (window < 0 && burst < 0)
+    {
+      last_error_ = "no valid parameters. Use: pacing:::win:PERCENT:::burst:BYTES";
+      return;
+    }
+
+    if (window > 100)
+    {
+      last_error_ = "pacing window must be between 0 and 100 percent";
+      return;
+    }
+
+    ctx.pacer->configure(window >= 0 ? window : ctx.pacer->windowPercent(),
+                         burst >= 0 ? burst : ctx.pacer->burstBytes());
+  }
+
+  void handleFec(const char *cmd, const Context &ctx)
+  {
+    if (!ctx.fec)
+    {
+      last_error_ = "fec not available";
+      return;
+    }
+
+    int group = -1, key_group = -1;
+    parseFecParams(cmd, group, key_group);
+
+    if (group < 0 && key_group < 0)
+    {
+      last_error_ = "no valid parameters. Use: fec:::k:PACKETS:::idr:PACKETS";
+      return;
+    }
+
+    if (group > static_cast<int>(RTP_FEC_MAX_GROUP) || key_group > static_cast<int>(RTP_FEC_MAX_GROUP))
+    {
+      last_error_ = "fec group must be between 0 and 16 packets";
+      return;
+    }
+
+    ctx.fec->configure(group >= 0 ? group : ctx.fec->group(),
+                       key_group >= 0 ? key_group : ctx.fec->keyGroup());
+  }
+
+  // transport:::raw sends media through the lwIP raw API in batches,
+  // transport:::socket through sendmsg(); applied by the data task
+  void handleTransport(const char *cmd, const Context &ctx)
+  {
+    if (!ctx.raw_transport)
+    {
+      last_error_ = "transport switching not available";
+      return;
+    }
+
+    if (strstr(cmd, ":::raw"))
+      ctx.raw_transport->store(true);
+    else if (strstr(cmd, ":::socket"))
+      ctx.raw_transport->store(false);
+    else
+      last_error_ = "transport requires a backend: transport:::raw or transport:::socket";
+  }
+
+  // Both send backends back to back with RTP-sized packets to the requester:
+  // netbench:::packets:N:::size:BYTES:::port:PORT. Only while not streaming,
+  // the sends would compete with the stream and the control task is blocked
+  // for the duration.
+  Result handleNetbench(const char *cmd, const Context &ctx)
+  {
+    if (ctx.stream_active->load())
+    {
+      last_error_ = "netbench requires the stream to be stopped";
+      return {nullptr};
+    }
+
+    int packets = 5000, size = 1200, port = -1;
+    parseNetbenchParams(cmd, packets, size, port);
+    if (packets < 1 || packets > 50000 || size < 1 || size > 1400 || port == 0 || port > 65535)
+    {
+      last_error_ = "netbench packets must be between 1 and 50000, size between 1 and 1400 bytes";
+      return {nullptr};
+    }
+
+    struct sockaddr_in dest = *ctx.source_addr;
+    if (port > 0)
+      dest.sin_port = htons(static_cast<uint16_t>(port));
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
+    {
+      last_error_ = "netbench failed to create a socket";
+      return {nullptr};
+    }
+
+    UDPTransportBenchResult results[2];
+    {
+      UDPTransport transport(sock);
+      results[0] = UDPTransportBench::run(transport, dest, packets, size);
+      if (transport.setRaw(true))
+        results[1] = UDPTransportBench::run(transport, dest, packets, size);
+    }
+    close(sock);
+
+    int len = snprintf(info_buffer_, sizeof(info_buffer_), "{\"packets\":%d,\"size\":%d", packets, size);
+    const char *names[2] = {"socket", "raw"};
+    for (int i = 0; i < 2 && len < static_cast<int>(sizeof(info_buffer_)); i++)
+    {
+      const UDPTransportBenchResult &r = results[i];
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len,
+                      ",\"%s\":{\"pps\":%lu,\"sent\":%lu,\"dropped\":%lu,\"cpu\":%.1f,\"tcpip\":%.1f,\"sender\":%.1f}",
+                      names[i], r.packetsPerSecond(), r.sent, r.dropped, r.cpu_percent, r.tcpip_percent, r.sender_percent);
+    }
+    if (len < static_cast<int>(sizeof(info_buffer_)))
+      snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "}");
+    return {info_buffer_};
+  }
+
+  // abr:::on, abr:::off, abr:::floor:KBPS:::ceiling:KBPS:::hold:MS; options
+  // not given keep their values
+  void handleAbr(const char *cmd, const Context &ctx)
+  {
+    if (!ctx.abr)
+    {
+      last_error_ = "abr not available";
+      return;
+    }
+
+    if (strstr(cmd, ":::on"))
+    {
+      ctx.abr->setEnabled(true);
+      return;
+    }
+    if (strstr(cmd, ":::off"))
+    {
+      ctx.abr->setEnabled(false);
+      return;
+    }
+
+    AbrConfig config = ctx.abr->config();
+    int floor = -1, ceiling = -1, hold = -1;
+    parseAbrParams(cmd, floor, ceiling, hold);
+    if (floor < 0 && ceiling < 0 && hold < 0)
+    {
+      last_error_ = "no valid parameters. Use: abr:::on, abr:::off or abr:::floor:KBPS:::ceiling:KBPS:::hold:MS";
+      return;
+    }
+
+    uint32_t floor_bps = floor >= 0 ? static_cast<uint32_t>(floor) * 1000 : config.floor_bps;
+    uint32_t ceiling_bps = ceiling >= 0 ? static_cast<uint32_t>(ceiling) * 1000 : config.ceiling_bps;
+    if (floor > 100000 || ceiling > 100000 || !ctx.abr->configure(floor_bps, ceiling_bps, hold >= 0 ? hold : config.hold_ms))
+      last_error_ = "abr floor must be between 1 and ceiling, ceiling at most 100000 kbit/s";
+  }
+
+  // Current target and the recent decisions with the signals behind each,
+  // newest first
+  Result handleAbrStatus(const Context &ctx)
+  {
+    if (!ctx.abr)
+    {
+      last_error_ = "abr not available";
+      return {nullptr};
+    }
+
+    AbrConfig config = ctx.abr->config();
+    int len = snprintf(info_buffer_, sizeof(info_buffer_),
+                       "{\"enabled\":%s,\"kbps\":%lu,\"max_qp\":%d,\"floor_kbps\":%lu,\"ceiling_kbps\":%lu,\"hold_ms\":%lu,\"log\":[",
+                       config.enabled ? "true" : "false", ctx.abr->bitrate() / 1000, ctx.abr->maxQp(),
+                       config.floor_bps / 1000, config.ceiling_bps / 1000, config.hold_ms);
+
+    AbrDecision log[AbrController::LOG_SIZE];
+    size_t count = ctx.abr->history(log, AbrController::LOG_SIZE);
+    for (size_t i = 0; i < count && len < static_cast<int>(sizeof(info_buffer_)); i++)
+    {
+      const AbrDecision &d = log[i];
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len,
+                      "%s{\"time_ms\":%lu,\"from_kbps\":%lu,\"to_kbps\":%lu,\"max_qp\":%d,\"reason\":\"%s\",\"loss\":%.3f,"
+                      "\"drops\":%lu,\"packets\":%lu,\"rtt_us\":%lu,\"backlog\":%lu,\"stalls\":%lu}",
+                      i ? "," : "", d.time_ms, d.from_bps / 1000, d.to_bps / 1000, d.max_qp, abrReasonName(d.reason),
+                      d.signals.loss, d.signals.drops, d.signals.packets, d.signals.rtt_us, d.signals.backlog, d.signals.stalls);
+    }
+    if (len < static_cast<int>(sizeof(info_buffer_)))
+      snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "]}");
+    return {info_buffer_};
+  }
+
+  // keyframe asks for an IDR like an RTCP PLI; keyframe:::interval:MS sets
+  // how far apart forced IDRs are at least
+  void handleKeyframe(const char *cmd, const Context &ctx)
+  {
+    if (!ctx.keyframes)
+    {
+      last_error_ = "keyframe requests not available";
+      return;
+    }
+
+    const char *interval = strstr(cmd, ":::interval:");
+    if (!interval)
+    {
+      ctx.keyframes->request();
+      return;
+    }
+
+    int ms = atoi(interval + 12);
+    if (ms < 0 || ms > 60000)
+    {
+      last_error_ = "keyframe interval must be between 0 and 60000 ms";
+      return;
+    }
+    ctx.keyframes->setMinInterval(static_cast<uint32_t>(ms));
+  }
+
+  // Link quality per viewer for fleet polling: totals since the viewer
+  // joined, rates over the last second, ages in ms (-1 = none yet). Drops
+  // are packets refused by a full TX queue (ENOMEM/ENOBUFS), errors are hard
+  // send errors that ended a frame.
+  Result handleReport(const Context &ctx)
+  {
+    uint32_t now_ms = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+    auto age = [now_ms](uint32_t ms)
+    { return ms ? static_cast<long>(now_ms - ms) : -1L; };
+
+    bool jpeg = ctx.capture && ctx.capture->getConfig().codec == V4L2H264Capture::Codec::JPEG;
+    const StreamReportCounters *r = ctx.report;
+    int len = snprintf(info_buffer_, sizeof(info_buffer_),
+                       "{\"uptime_ms\":%lu,\"status\":\"%s\",\"codec\":\"%s\",\"frames\":%lu,\"fps\":%lu,\"kbps\":%lu,"
+                       "\"target_kbps\":%lu,\"idr_age_ms\":%ld,\"fec\":[%u,%u],\"viewers\":[",
+                       now_ms, ctx.stream_active->load() ? "streaming" : "ready", jpeg ? "jpeg" : "h264",
+                       r ? r->frames.load() : 0, r ? r->fps.load() : 0, r ? r->kbps.load() : 0,
+                       ctx.abr && !jpeg ? ctx.abr->bitrate() / 1000 : 0, r ? age(r->last_keyframe_ms.load()) : -1L,
+                       ctx.fec ? ctx.fec->group() : 0, ctx.fec ? ctx.fec->keyGroup() : 0);
+
+    len = writeViewers(len, ctx, now_ms);
+    if (len < static_cast<int>(sizeof(info_buffer_)))
+      snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "]}");
+    return {info_buffer_};
+  }
+
+  // Appends one JSON object per viewer at info_buffer_ + len for info and
+  // report: totals since the viewer joined, rates over the last second,
+  // send_us_per_frame spent in the send backend, bytes wasted on partial
+  // frames and saved while waiting for an IDR, and the age of the last IDR
+  // it received in full (-1 = none yet). Returns the new length.
+  int writeViewers(int len, const Context &ctx, uint32_t now_ms)
+  {
+    StreamClientTable::Destination viewers[STREAM_MAX_CLIENTS + 1];
+    size_t viewer_count = ctx.clients->snapshot(viewers);
+    for (size_t i = 0; i < viewer_count && len < static_cast<int>(sizeof(info_buffer_)); i++)
+    {
+      char ip[16];
+      inet_ntoa_r(viewers[i].addr.sin_addr, ip, sizeof(ip));
+      const StreamClientStats &v = ctx.clients->stats(viewers[i].index);
+      uint32_t frames = v.frames.load();
+      uint32_t last_keyframe_ms = v.last_keyframe_ms.load();
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len,
+                      "%s{\"addr\":\"%s:%u\",\"frames\":%lu,\"packets\":%lu,\"bytes\":%lu,\"kbps\":%lu,\"fps\":%lu,"
+                      "\"drops\":%lu,\"errors\":%lu,\"rtx\":%lu,\"fec\":%lu,\"send_us_per_frame\":%lu,"
+                      "\"skipped_frames\":%lu,\"wasted_bytes\":%lu,\"saved_bytes\":%lu,\"idr_age_ms\":%ld}",
+                      i ? "," : "", ip, ntohs(viewers[i].addr.sin_port), frames, v.packets.load(), v.bytes.load(),
+                      v.rate_kbps.load(), v.rate_fps.load(), v.drops.load(), v.errors.load(), v.retransmits.load(),
+                      v.fec_packets.load(), frames ? v.send_us.load() / frames : 0, v.skipped_frames.load(),
+                      v.wasted_bytes.load(), v.saved_bytes.load(),
+                      last_keyframe_ms ? static_cast<long>(now_ms - last_keyframe_ms) : -1L);
+    }
+    return len;
+  }
+
+  // Per-stage percentiles in microseconds since boot or the last
+  // latency:::reset, which returns the histograms before clearing them
+  Result handleLatency(const char *cmd, const Context &ctx)
+  {
+    if (!ctx.latency)
+    {
+      last_error_ = "latency histograms not available";
+      return {nullptr};
+    }
+
+    int len = snprintf(info_buffer_, sizeof(info_buffer_), "{");
+    for (int stage = 0; stage < PipelineLatency::STAGE_COUNT && len < static_cast<int>(sizeof(info_buffer_)); stage++)
+    {
+      auto s = static_cast<PipelineLatency::Stage>(stage);
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "%s\"%s\":{", stage ? "," : "",
+                      PipelineLatency::stageName(s));
+      for (int type = 0; type < PipelineLatency::TYPE_COUNT && len < static_cast<int>(sizeof(info_buffer_)); type++)
+      {
+        auto t = static_cast<PipelineLatency::FrameType>(type);
+        const LatencyHistogram &h = ctx.latency->histogram(s, t);
+        len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len,
+                        "%s\"%s\":{\"n\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu}",
+                        type ? "," : "", PipelineLatency::typeName(t), h.count(), h.percentile(50), h.percentile(90),
+                        h.percentile(99), h.max());
+      }
+      if (len < static_cast<int>(sizeof(info_buffer_)))
+        len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "}");
+    }
+    if (len < static_cast<int>(sizeof(info_buffer_)))
+      snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "}");
+
+    if (strstr(cmd, ":::reset"))
+      ctx.latency->reset();
+    return {info_buffer_};
+  }
+
+  // Compact alternative to RTCP generic NACK: nack:::SEQ:::SEQ...
+  void handleNack(const char *cmd, const Context &ctx)
+  {
+    if (!ctx.nack)
+    {
+      last_error_ = "retransmission not available";
+      return;
+    }
+
+    const char *pos = strstr(cmd, ":::");
+    if (!pos)
+    {
+      last_error_ = "nack requires sequence numbers: nack:::SEQ:::SEQ";
+      return;
+    }
+
+    while (pos)
+    {
+      pos += 3;
+      ctx.nack(*ctx.source_addr, static_cast<uint16_t>(atoi(pos)));
+      pos = strstr(pos, ":::");
+    }
+  }
+
+  // Sends to a group alongside the unicast viewers:
+  // multicast:::group:ADDR:::port:PORT:::ttl:TTL:::join:1, multicast:::off
+  void handleMulticast(const char *cmd, const Context &ctx)
+  {
+    if (strstr(cmd, ":::off"))
+    {
+      ctx.clients->clearMulticast();
+      if (ctx.clients->size() == 0)
+        ctx.stream_active->store(false);
+      return;
+    }
+
+    // Options not given keep the values of the current group
+    StreamMulticastSettings settings;
+    ctx.clients->multicast(settings);
+    char group[16] = {};
+    int port = -1, ttl = -1, join = -1;
+    parseMulticastParams(cmd, group, sizeof(group), port, ttl, join);
+
+    if (group[0] && !inet_aton(group, &settings.group))
+      settings.group.s_addr = 0;
+    if (!isMulticastAddress(settings.group))
+    {
+      last_error_ = "multicast requires a group in 224.0.0.0/4: multicast:::group:ADDR:::port:PORT:::ttl:TTL:::join:1";
+      return;
+    }
+    if (port == 0 || port > 65534 || ttl == 0 || ttl > 255)
+    {
+      last_error_ = "multicast port must be between 1 and 65534, ttl between 1 and 255";
+      return;
+    }
+
+    if (port > 0)
+      settings.port = static_cast<uint16_t>(port);
+    if (ttl > 0)
+      settings.ttl = static_cast<uint8_t>(ttl);
+    if (join >= 0)
+      settings.join = join > 0;
+
+    // Group receivers decode from the next frame instead of the next IDR
+    ctx.clients->setMulticast(settings);
+    if (ctx.resend_parameter_sets)
+      ctx.resend_parameter_sets->store(true);
+    if (ctx.keyframes)
+      ctx.keyframes->request();
+    ctx.stream_active->store(true);
+  }
+
   void handleMusicPlay(const char *cmd, const Context &ctx)
   {
     const char *delim = strstr(cmd, ":::");
@@ -246,6 +766,171 @@ private:
     }
   }
 
+  void parsePacingParams(const char *cmd, int &window, int &burst)
+  {
+    const char *pos = cmd;
+
+    while (pos && *pos)
+    {
+      const char *next = strstr(pos, ":::");
+      if (!next)
+        break;
+
+      pos = next + 3;
+
+      if (strncmp(pos, "win:", 4) == 0)
+      {
+        window = atoi(pos + 4);
+      }
+      else if (strncmp(pos, "burst:", 6) == 0)
+      {
+        burst = atoi(pos + 6);
+      }
+    }
+  }
+
+  void parseAbrParams(const char *cmd, int &floor, int &ceiling, int &hold)
+  {
+    const char *pos = cmd;
+
+    while (pos && *pos)
+    {
+      const char *next = strstr(pos, ":::");
+      if (!next)
+        break;
+
+      pos = next + 3;
+
+      if (strncmp(pos, "floor:", 6) == 0)
+      {
+        floor = atoi(pos + 6);
+      }
+      else if (strncmp(pos, "ceiling:", 8) == 0)
+      {
+        ceiling = atoi(pos + 8);
+      }
+      else if (strncmp(pos, "hold:", 5) == 0)
+      {
+        hold = atoi(pos + 5);
+      }
+    }
+  }
+
+  void parseNetbenchParams(const char *cmd, int &packets, int &size, int &port)
+  {
+    const char *pos = cmd;
+
+    while (pos && *pos)
+    {
+      const char *next = strstr(pos, ":::");
+      if (!next)
+        break;
+
+      pos = next + 3;
+
+      if (strncmp(pos, "packets:", 8) == 0)
+      {
+        packets = atoi(pos + 8);
+      }
+      else if (strncmp(pos, "size:", 5) == 0)
+      {
+        size = atoi(pos + 5);
+      }
+      else if (strncmp(pos, "port:", 5) == 0)
+      {
+        port = atoi(pos + 5);
+      }
+    }
+  }
+
+  void parseFecParams(const char *cmd, int &group, int &key_group)
+  {
+    const char *pos = cmd;
+
+    while (pos && *pos)
+    {
+      const char *next = strstr(pos, ":::");
+      if (!next)
+        break;
+
+      pos = next + 3;
+
+      if (strncmp(pos, "k:", 2) == 0)
+      {
+        group = atoi(pos + 2);
+      }
+      else if (strncmp(pos, "idr:", 4) == 0)
+      {
+        key_group = atoi(pos + 4);
+      }
+    }
+  }
+
+  void parseMulticastParams(const char *cmd, char *group, size_t group_size, int &port, int &ttl, int &join)
+  {
+    const char *pos = cmd;
+
+    while (pos && *pos)
+    {
+      const char *next = strstr(pos, ":::");
+      if (!next)
+        break;
+
+      pos = next + 3;
+
+      if (strncmp(pos, "group:", 6) == 0)
+      {
+        const char *value = pos + 6;
+        const char *end = strstr(value, ":::");
+        size_t len = end ? static_cast<size_t>(end - value) : strlen(value);
+        if (len < group_size)
+        {
+          memcpy(group, value, len);
+          group[len] = '\0';
+        }
+      }
+      else if (strncmp(pos, "port:", 5) == 0)
+      {
+        port = atoi(pos + 5);
+      }
+      else if (strncmp(pos, "ttl:", 4) == 0)
+      {
+        ttl = atoi(pos + 4);
+      }
+      else if (strncmp(pos, "join:", 5) == 0)
+      {
+        join = atoi(pos + 5);
+      }
+    }
+  }
+
+  void parseStartParams(const char *cmd, int &stap, int &ext, int &jpeg)
+  {
+    const char *pos = cmd;
+
+    while (pos && *pos)
+    {
+      const char *next = strstr(pos, ":::");
+      if (!next)
+        break;
+
+      pos = next + 3;
+
+      if (strncmp(pos, "stap:", 5) == 0)
+      {
+        stap = atoi(pos + 5);
+      }
+      else if (strncmp(pos, "ext:", 4) == 0)
+      {
+        ext = atoi(pos + 4);
+      }
+      else if (strncmp(pos, "jpeg:", 5) == 0)
+      {
+        jpeg = atoi(pos + 5);
+      }
+    }
+  }
+
   Result handleInfo(const Context &ctx)
   {
     int64_t now_us = esp_timer_get_time();
@@ -262,14 +947,108 @@ private:
 
     const char *streaming_status = ctx.stream_active->load() ? "streaming" : "ready";
     const char *last_error = last_error_.empty() ? "" : last_error_.c_str();
+    const char *transport = ctx.raw_transport && ctx.raw_transport->load() ? "raw" : "socket";
 
-    snprintf(info_buffer_, sizeof(info_buffer_),
-             "{\"time\":%lld,\"temp\":%.2f,\"signal\":%d,\"free_heap\":%zu,\"free_block\":%zu,\"status\":\"%s\",\"last_error\":\"%s\"}",
-             now_us, temp, signal, free_mem, free_block, streaming_status, last_error);
+    int len = snprintf(info_buffer_, sizeof(info_buffer_),
+                       "{\"time\":%lld,\"temp\":%.2f,\"signal\":%d,\"free_heap\":%zu,\"free_block\":%zu,\"status\":\"%s\",\"last_error\":\"%s\",\"transport\":\"%s\",\"clients\":[",
+                       now_us, temp, signal, free_mem, free_block, streaming_status, last_error, transport);
 
+    // Receiver feedback from RTCP reports, one entry per reporting client
+    bool first = true;
+    RTCPClientStats reporters[RTCP_MAX_CLIENTS];
+    if (ctx.rtcp)
+      ctx.rtcp->snapshot(reporters);
+    for (size_t i = 0; ctx.rtcp && i < RTCP_MAX_CLIENTS; i++)
+    {
+      const RTCPClientStats &c = reporters[i];
+      if (c.ssrc == 0 || len >= static_cast<int>(sizeof(info_buffer_)))
+        continue;
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len,
+                      "%s{\"ssrc\":%lu,\"loss\":%.3f,\"lost\":%ld,\"jitter_us\":%lu,\"rtt_us\":%lu,\"reports\":%lu}",
+                      first ? "" : ",", c.ssrc, c.fraction_lost, c.cumulative_lost, c.jitter_us, c.rtt_us, c.reports);
+      first = false;
+    }
+
+    if (len < static_cast<int>(sizeof(info_buffer_)))
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "],\"viewers\":[");
+
+    len = writeViewers(len, ctx, static_cast<uint32_t>(now_us / 1000));
+
+    if (len < static_cast<int>(sizeof(info_buffer_)))
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "]");
+
+    // Capture -> send handoff; loads are percent busy over the last second
+    if (ctx.pipeline && len < static_cast<int>(sizeof(info_buffer_)))
+    {
+      const StreamPipelineStats &p = *ctx.pipeline;
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len,
+                      ",\"pipeline\":{\"depth\":%lu,\"capacity\":%lu,\"max_depth\":%lu,\"capture_load\":%lu,\"send_load\":%lu,\"stalls\":%lu}",
+                      p.depth.load(), p.capacity.load(), p.max_depth.load(), p.capture_load.load(), p.send_load.load(),
+                      p.stalls.load());
+    }
+
+    // Forced IDRs are at most one per min_interval_ms however many requests
+    if (ctx.keyframes && len < static_cast<int>(sizeof(info_buffer_)))
+    {
+      len += snprintf(info_buffer_ + len, sizeof(info_buffer_) - len,
+                      ",\"keyframes\":{\"requested\":%lu,\"forced\":%lu,\"min_interval_ms\":%lu}",
+                      ctx.keyframes->requested(), ctx.keyframes->forced(), ctx.keyframes->minIntervalMs());
+    }
+
+    if (len < static_cast<int>(sizeof(info_buffer_)))
+      snprintf(info_buffer_ + len, sizeof(info_buffer_) - len, "}");
+
+    return {info_buffer_};
+  }
+
+  // Session description for the multicast group while one is active, else
+  // for the requester as a unicast viewer on the port it asked from
+  Result handleSdp(const Context &ctx)
+  {
+    SdpStreamDescription d;
+    StreamMulticastSettings multicast;
+    if (ctx.clients->multicast(multicast))
+    {
+      d.destination = multicast.group;
+      d.port = multicast.port;
+      d.ttl = multicast.ttl;
+    }
+    else
+    {
+      d.destination = ctx.source_addr->sin_addr;
+      d.port = ntohs(ctx.source_addr->sin_port);
+    }
+    d.origin = localAddress(*ctx.source_addr);
+    d.session_id = ctx.rtcp ? ctx.rtcp->ssrc() : 0;
+    d.jpeg = ctx.capture && ctx.capture->getConfig().codec == V4L2H264Capture::Codec::JPEG;
+    d.header_extensions = ctx.packetizer && ctx.packetizer->headerExtensions();
+    d.fec = ctx.fec && (ctx.fec->group() > 0 || ctx.fec->keyGroup() > 0);
+
+    if (SdpWriter(info_buffer_, sizeof(info_buffer_)).write(d) == 0)
+    {
+      last_error_ = "sdp does not fit the response buffer";
+      return {nullptr};
+    }
     return {info_buffer_};
   }
 
+  // Address of the interface that routes to peer; connecting a UDP socket
+  // only selects the route, nothing is sent
+  static struct in_addr localAddress(const struct sockaddr_in &peer)
+  {
+    struct sockaddr_in local = {};
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock >= 0)
+    {
+      socklen_t len = sizeof(local);
+      if (connect(sock, (const struct sockaddr *)&peer, sizeof(peer)) < 0 ||
+          getsockname(sock, (struct sockaddr *)&local, &len) < 0)
+        local.sin_addr.s_addr = 0;
+      close(sock);
+    }
+    return local.sin_addr;
+  }
+
   void handleClearError(const Context &ctx)
   {
     last_error_.clear();
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+
+#include "rtp_packetizer_mod.hpp"
+
+// Latest SPS/PPS seen in the encoder output, kept as a ready-to-packetize
+// Annex B buffer so a joining client or a frame after a lost parameter-set
+// packet can be decoded without waiting for the encoder's next IDR.
+class H264ParameterSetCache
+{
+public:
+  static constexpr size_t MAX_NAL_SIZE = 256;
+
+  struct FrameInfo
+  {
+    bool parameter_sets; // frame carries its own SPS and PPS
+    bool keyframe;       // frame has an IDR slice
+  };
+
+  // Scans the NAL units in front of the first slice and takes over any SPS or
+  // PPS found there. Only the frame head is read, slice data is never scanned.
+  FrameInfo update(const uint8_t *frame, size_t size)
+  {
+    FrameInfo info = {false, false};
+    bool sps = false, pps = false;
+    const uint8_t *end = frame + size;
+    uint8_t sc_len = 0;
+
+    const uint8_t *sc = RTPPacketizer::findStartCode(frame, end, sc_len);
+    while (sc)
+    {
+      const uint8_t *nal = sc + sc_len;
+      if (nal >= end)
+        break;
+
+      uint8_t type = nal[0] & 0x1F;
+      if (type >= 1 && type <= 5)
+      {
+        info.keyframe = type == 5;
+        break;
+      }
+
+      const uint8_t *next = RTPPacketizer::findStartCode(nal + 1, end, sc_len);
+      size_t nal_size = (next ? next : end) - nal;
+      if (type == 7)
+        sps |= store(sps_, sps_size_, nal, nal_size);
+      else if (type == 8)
+        pps |= store(pps_, pps_size_, nal, nal_size);
+      sc = next;
+    }
+
+    info.parameter_sets = sps && pps;
+    return info;
+  }
+
+  void invalidate()
+  {
+    sps_size_ = 0;
+    pps_size_ = 0;
+    annexb_size_ = 0;
+  }
+
+  bool valid() const { return sps_size_ > 0 && pps_size_ > 0; }
+
+  // SPS then PPS with 4-byte start codes, empty while not valid
+  const uint8_t *data()
+  {
+    if (valid() && annexb_size_ == 0)
+    {
+      annexb_size_ = append(annexb_, 0, sps_, sps_size_);
+      annexb_size_ = append(annexb_, annexb_size_, pps_, pps_size_);
+    }
+    return annexb_;
+  }
+
+  size_t size() const { return valid() ? 2 * sizeof(START_CODE) + sps_size_ + pps_size_ : 0; }
+
+private:
+  static constexpr uint8_t START_CODE[4] = {0x00, 0x00, 0x00, 0x01};
+
+  uint8_t sps_[MAX_NAL_SIZE];
+  uint8_t pps_[MAX_NAL_SIZE];
+  size_t sps_size_ = 0;
+  size_t pps_size_ = 0;
+  uint8_t annexb_[2 * (sizeof(START_CODE) + MAX_NAL_SIZE)];
+  size_t annexb_size_ = 0;
+
+  bool store(uint8_t *dst, size_t &dst_size, const uint8_t *nal, size_t size)
+  {
+    // Trailing zero bytes belong to the next start code
+    while (size > 1 && nal[size - 1] == 0)
+      size--;
+    if (size > MAX_NAL_SIZE)
+      return false;
+
+    if (size != dst_size || memcmp(dst, nal, size) != 0)
+    {
+      memcpy(dst, nal, size);
+      dst_size = size;
+      annexb_size_ = 0;
+    }
+    return true;
+  }
+
+  static size_t append(uint8_t *dst, size_t pos, const uint8_t *nal, size_t size)
+  {
+    memcpy(dst + pos, START_CODE, sizeof(START_CODE));
+    memcpy(dst + pos + sizeof(START_CODE), nal, size);
+    return pos + sizeof(START_CODE) + size;
+  }
+};
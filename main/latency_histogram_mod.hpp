@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-bucket latency histogram in microseconds: exact below 8 us, then 8
+// buckets per power of two up to 2^23 us (8.4 s), so a percentile is at most
+// 12.5% above the true value. record() is a relaxed increment on one bucket;
+// reading and reset() may run on another task, a sample racing a reset can
+// land on either side of it. Standard library only.
+class LatencyHistogram
+{
+public:
+  static constexpr size_t SUB_BUCKETS = 8;
+  static constexpr size_t MAX_OCTAVE = 23;
+  static constexpr size_t BUCKETS = (MAX_OCTAVE - 2) * SUB_BUCKETS;
+
+  void record(uint32_t us)
+  {
+    buckets_[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = max_.load(std::memory_order_relaxed);
+    while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  void reset()
+  {
+    for (auto &bucket : buckets_)
+      bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+  uint32_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint32_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  // Upper bound of the bucket holding the given percentile (0..100), capped
+  // at the recorded maximum; 0 if empty
+  uint32_t percentile(uint32_t percent) const
+  {
+    uint32_t total = 0;
+    uint32_t counts[BUCKETS];
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      total += counts[i];
+    }
+    if (total == 0)
+      return 0;
+
+    uint64_t rank = (static_cast<uint64_t>(total) * percent + 99) / 100;
+    if (rank == 0)
+      rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+      {
+        uint32_t upper = upperBound(i);
+        uint32_t max = max_.load(std::memory_order_relaxed);
+        return upper < max || max == 0 ? upper : max;
+      }
+    }
+    return max();
+  }
+
+  static size_t bucketOf(uint32_t us)
+  {
+    if (us < SUB_BUCKETS)
+      return us;
+    uint32_t octave = 31 - __builtin_clz(us);
+    if (octave >= MAX_OCTAVE)
+      return BUCKETS - 1;
+    uint32_t sub = (us >> (octave - 3)) & (SUB_BUCKETS - 1);
+    return (octave - 2) * SUB_BUCKETS + sub;
+  }
+
+  static uint32_t upperBound(size_t bucket)
+  {
+    if (bucket < SUB_BUCKETS)
+      return static_cast<uint32_t>(bucket);
+    uint32_t octave = static_cast<uint32_t>(bucket / SUB_BUCKETS) + 2;
+    uint32_t sub = static_cast<uint32_t>(bucket % SUB_BUCKETS);
+    uint32_t width = 1u << (octave - 3);
+    return ((SUB_BUCKETS + sub) << (octave - 3)) + width - 1;
+  }
+
+private:
+  std::atomic<uint32_t> buckets_[BUCKETS] = {};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint32_t> max_{0};
+};
+
+// Timestamps of one frame through the pipeline, esp_timer clock
+struct FrameTimestamps
+{
+  int64_t capture_us = 0;         // sensor frame time
+  int64_t dequeued_us = 0;        // raw frame taken from the capture device
+  int64_t encoder_queued_us = 0;  // raw frame queued to the encoder (QBUF)
+  int64_t encoded_us = 0;         // encoded frame taken from the encoder (DQBUF)
+  int64_t packetize_start_us = 0; // send stage picked the frame up
+  int64_t packetize_end_us = 0;   // RTP and FEC packets ready
+  int64_t sent_us = 0;            // last send to the last viewer returned
+  bool keyframe = false;
+};
+
+// One histogram per stage and frame type, so an IDR's long encode and send
+// do not hide in the P-frame percentiles
+class PipelineLatency
+{
+public:
+  enum Stage
+  {
+    SENSOR,    // sensor frame time -> dequeued from the capture device
+    CAPTURE,   // dequeued -> queued to the encoder
+    ENCODE,    // encoder QBUF -> DQBUF
+    QUEUE,     // encoded -> picked up by the send stage
+    PACKETIZE, // RTP/FEC packetization
+    SEND,      // first packet -> last send returned, incl. pacing and lwIP
+    TOTAL,     // sensor frame time -> last send returned
+    STAGE_COUNT,
+  };
+
+  enum FrameType
+  {
+    KEY,
+    DELTA,
+    TYPE_COUNT,
+  };
+
+  void record(const FrameTimestamps &t)
+  {
+    LatencyHistogram *h = histograms_[t.keyframe ? KEY : DELTA];
+    h[SENSOR].record(span(t.capture_us, t.dequeued_us));
+    h[CAPTURE].record(span(t.dequeued_us, t.encoder_queued_us));
+    h[ENCODE].record(span(t.encoder_queued_us, t.encoded_us));
+    h[QUEUE].record(span(t.encoded_us, t.packetize_start_us));
+    h[PACKETIZE].record(span(t.packetize_start_us, t.packetize_end_us));
+    h[SEND].record(span(t.packetize_end_us, t.sent_us));
+    h[TOTAL].record(span(t.capture_us, t.sent_us));
+  }
+
+  void reset()
+  {
+    for (auto &type : histograms_)
+      for (auto &h : type)
+        h.reset();
+  }
+
+  const LatencyHistogram &histogram(Stage stage, FrameType type) const { return histograms_[type][stage]; }
+
+  static const char *stageName(Stage stage)
+  {
+    static constexpr const char *names[STAGE_COUNT] = {"sensor", "capture", "encode", "queue", "packetize", "send", "total"};
+    return names[stage];
+  }
+
+  static const char *typeName(FrameType type) { return type == KEY ? "key" : "delta"; }
+
+private:
+  LatencyHistogram histograms_[TYPE_COUNT][STAGE_COUNT];
+
+  static uint32_t span(int64_t from, int64_t to)
+  {
+    return to > from ? static_cast<uint32_t>(to - from) : 0;
+  }
+};
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+
+#include "rtp_packetizer_mod.hpp"
+
+// RFC 3550 RTCP for the sending side: compound SR + SDES generation and
+// RR/SR report-block and RFC 3611 XR processing, giving per-receiver loss,
+// jitter and round-trip time, plus PLI/FIR keyframe requests. Standard
+// library only.
+
+static constexpr uint8_t RTCP_PT_SR = 200;
+static constexpr uint8_t RTCP_PT_RR = 201;
+static constexpr uint8_t RTCP_PT_SDES = 202;
+static constexpr uint8_t RTCP_PT_PSFB = 206;
+static constexpr uint8_t RTCP_PT_XR = 207;
+static constexpr uint8_t RTCP_FMT_PLI = 1;
+static constexpr uint8_t RTCP_FMT_FIR = 4;
+static constexpr uint8_t RTCP_SDES_CNAME = 1;
+static constexpr uint8_t RTCP_XR_RRTR = 4;
+static constexpr uint8_t RTCP_XR_DLRR = 5;
+// One reporter per unicast viewer (STREAM_MAX_CLIENTS) plus the multicast group
+static constexpr size_t RTCP_MAX_CLIENTS = 8 + 1;
+static constexpr uint64_t NTP_UNIX_OFFSET_S = 2208988800ULL; // 1900 -> 1970
+
+// 64-bit NTP timestamp (32.32 fixed point seconds since 1900)
+inline uint64_t ntpFromUnixUs(uint64_t unix_us)
+{
+  uint64_t seconds = unix_us / 1000000ULL + NTP_UNIX_OFFSET_S;
+  uint64_t fraction = ((unix_us % 1000000ULL) << 32) / 1000000ULL;
+  return (seconds << 32) | fraction;
+}
+
+// Middle 32 bits, the 16.16 form used by LSR/DLSR and XR
+inline uint32_t ntpCompact(uint64_t ntp) { return static_cast<uint32_t>(ntp >> 16); }
+
+struct RTCPClientStats
+{
+  uint32_t ssrc = 0; // reporter SSRC, 0 = free slot
+  float fraction_lost = 0; // since the previous report, 0..1
+  int32_t cumulative_lost = 0;
+  uint32_t highest_seq = 0; // extended highest sequence received
+  uint32_t jitter_us = 0;
+  uint32_t rtt_us = 0; // 0 until a report echoes one of our SRs
+  uint32_t reports = 0;
+  uint64_t last_report_ntp = 0;
+  // The sender withheld frames from this receiver since its previous report,
+  // so part of the reported loss is not congestion
+  bool media_withheld = false;
+};
+
+// True if a (compound) RTCP packet asks for a keyframe of media_ssrc: an
+// RFC 4585 Picture Loss Indication (media SSRC in the header, 0 accepted
+// from receivers that do not track it) or an RFC 5104 Full Intra Request
+// (one FCI entry per media sender). FIR sequence numbers are not tracked, a
+// repeated FIR is absorbed by the caller's rate limit.
+inline bool parseKeyframeRequest(const uint8_t *data, size_t size, uint32_t media_ssrc)
+{
+  size_t pos = 0;
+  while (pos + 4 <= size)
+  {
+    const uint8_t *p = data + pos;
+    size_t length = (((p[2] << 8) | p[3]) + 1) * 4;
+    if ((p[0] >> 6) != RTP_VERSION || pos + length > size)
+      break;
+
+    if (p[1] == RTCP_PT_PSFB && length >= 12)
+    {
+      uint8_t fmt = p[0] & 0x1F;
+      uint32_t media = (uint32_t(p[8]) << 24) | (uint32_t(p[9]) << 16) | (uint32_t(p[10]) << 8) | p[11];
+      if (fmt == RTCP_FMT_PLI && (media == media_ssrc || media == 0))
+        return true;
+      for (size_t fci = 12; fmt == RTCP_FMT_FIR && fci + 8 <= length; fci += 8)
+      {
+        uint32_t ssrc = (uint32_t(p[fci]) << 24) | (uint32_t(p[fci + 1]) << 16) | (uint32_t(p[fci + 2]) << 8) | p[fci + 3];
+        if (ssrc == media_ssrc)
+          return true;
+      }
+    }
+    pos += length;
+  }
+  return false;
+}
+
+class RTCPSession
+{
+public:
+  explicit RTCPSession(uint32_t ssrc, const char *cname = "cyber-eye") : ssrc_(ssrc)
+  {
+    cname_size_ = static_cast<uint8_t>(std::min<size_t>(strlen(cname), sizeof(cname_)));
+    memcpy(cname_, cname, cname_size_);
+  }
+
+  // Compound SR + SDES(CNAME), followed by an XR DLRR block if a receiver
+  // sent an RRTR. ntp and rtp_timestamp must describe the same instant.
+  // Returns the size written, 0 if capacity is too small.
+  size_t writeSenderReport(uint8_t *out, size_t capacity, uint64_t ntp, uint32_t rtp_timestamp,
+                           uint32_t packet_count, uint32_t octet_count)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t sdes_size = 4 + 4 + ((2 + cname_size_ + 1 + 3) & ~size_t(3));
+    size_t xr_size = rrtr_ssrc_ ? 8 + 4 + 12 : 0;
+    if (capacity < 28 + sdes_size + xr_size)
+      return 0;
+
+    uint8_t *p = out;
+    p = writeHeader(p, 0, RTCP_PT_SR, 28);
+    p = put32(p, ssrc_);
+    p = put32(p, static_cast<uint32_t>(ntp >> 32));
+    p = put32(p, static_cast<uint32_t>(ntp));
+    p = put32(p, rtp_timestamp);
+    p = put32(p, packet_count);
+    p = put32(p, octet_count);
+
+    uint8_t *sdes = p;
+    p = writeHeader(p, 1, RTCP_PT_SDES, sdes_size);
+    p = put32(p, ssrc_);
+    *p++ = RTCP_SDES_CNAME;
+    *p++ = cname_size_;
+    memcpy(p, cname_, cname_size_);
+    p += cname_size_;
+    while (p < sdes + sdes_size)
+      *p++ = 0; // end of item list + padding to 32 bits
+
+    if (xr_size)
+    {
+      p = writeHeader(p, 0, RTCP_PT_XR, xr_size);
+      p = put32(p, ssrc_);
+      *p++ = RTCP_XR_DLRR;
+      *p++ = 0;
+      p = put16(p, 3);
+      p = put32(p, rrtr_ssrc_);
+      p = put32(p, rrtr_lrr_);
+      p = put32(p, ntpCompact(ntp) - rrtr_arrival_);
+    }
+
+    return p - out;
+  }
+
+  // Processes a compound RTCP packet from a receiver. Returns true if it
+  // carried a report block about our stream. media_withheld is recorded with
+  // the report, see RTCPClientStats.
+  bool processPacket(const uint8_t *data, size_t size, uint64_t ntp_now, bool media_withheld = false)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool reported = false;
+    size_t pos = 0;
+    while (pos + 8 <= size)
+    {
+      const uint8_t *p = data + pos;
+      size_t length = (((p[2] << 8) | p[3]) + 1) * 4;
+      if ((p[0] >> 6) != RTP_VERSION || pos + length > size)
+        break;
+
+      uint8_t count = p[0] & 0x1F;
+      uint32_t sender = get32(p + 4);
+      if (p[1] == RTCP_PT_RR)
+        reported |= processReportBlocks(sender, p + 8, count, length - 8, ntp_now, media_withheld);
+      else if (p[1] == RTCP_PT_SR && length >= 28)
+        reported |= processReportBlocks(sender, p + 28, count, length - 28, ntp_now, media_withheld);
+      else if (p[1] == RTCP_PT_XR)
+        processExtendedReport(sender, p + 8, length - 8, ntp_now);
+
+      pos += length;
+    }
+    return reported;
+  }
+
+  // Copies the per-reporter stats into out (RTCP_MAX_CLIENTS entries, free
+  // slots have ssrc 0), each entry as of one complete report
+  void snapshot(RTCPClientStats *out) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::copy(clients_, clients_ + RTCP_MAX_CLIENTS, out);
+  }
+
+  uint32_t ssrc() const { return ssrc_; }
+
+private:
+  uint32_t ssrc_;
+  char cname_[32];
+  uint8_t cname_size_;
+  // Reports are processed on the control task while others take snapshots
+  mutable std::mutex mutex_;
+  RTCPClientStats clients_[RTCP_MAX_CLIENTS];
+
+  // Last receiver reference time (XR RRTR), echoed back as DLRR
+  uint32_t rrtr_ssrc_ = 0;
+  uint32_t rrtr_lrr_ = 0;
+  uint32_t rrtr_arrival_ = 0;
+
+  static uint8_t *writeHeader(uint8_t *p, uint8_t count, uint8_t type, size_t size)
+  {
+    *p++ = static_cast<uint8_t>((RTP_VERSION << 6) | count);
+    *p++ = type;
+    return put16(p, static_cast<uint16_t>(size / 4 - 1));
+  }
+
+  static uint8_t *put16(uint8_t *p, uint16_t v)
+  {
+    p[0] = static_cast<uint8_t>(v >> 8);
+    p[1] = static_cast<uint8_t>(v);
+    return p + 2;
+  }
+
+  static uint8_t *put32(uint8_t *p, uint32_t v)
+  {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+    return p + 4;
+  }
+
+  static uint32_t get32(const uint8_t *p)
+  {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+  }
+
+  // Existing entry for the reporter, else a free or the least recently
+  // heard slot
+  RTCPClientStats &client(uint32_t reporter)
+  {
+    RTCPClientStats *oldest = &clients_[0];
+    for (auto &c : clients_)
+    {
+      if (c.ssrc == reporter)
+        return c;
+      if (c.last_report_ntp < oldest->last_report_ntp)
+        oldest = &c;
+    }
+    *oldest = {};
+    oldest->ssrc = reporter;
+    return *oldest;
+  }
+
+  bool processReportBlocks(uint32_t reporter, const uint8_t *p, uint8_t count, size_t size, uint64_t ntp_now,
+                           bool media_withheld)
+  {
+    bool reported = false;
+    for (uint8_t i = 0; i < count && (i + 1) * 24u <= size; i++, p += 24)
+    {
+      if (get32(p) != ssrc_)
+        continue;
+
+      RTCPClientStats &c = client(reporter);
+      c.fraction_lost = p[4] / 256.0f;
+      // 24-bit signed cumulative count
+      int32_t lost = (int32_t(p[5]) << 16) | (p[6] << 8) | p[7];
+      c.cumulative_lost = (lost & 0x800000) ? lost - 0x1000000 : lost;
+      c.highest_seq = get32(p + 8);
+      c.jitter_us = static_cast<uint32_t>(uint64_t(get32(p + 12)) * 1000000ULL / RTP_CLOCK_RATE);
+
+      // RTT = arrival - LSR - DLSR, all in 1/65536 s
+      uint32_t lsr = get32(p + 16);
+      uint32_t dlsr = get32(p + 20);
+      if (lsr != 0)
+      {
+        uint32_t rtt = ntpCompact(ntp_now) - lsr - dlsr;
+        if (rtt < 0x80000000u)
+          c.rtt_us = static_cast<uint32_t>(uint64_t(rtt) * 1000000ULL >> 16);
+      }
+
+      c.media_withheld = media_withheld;
+      c.reports++;
+      c.last_report_ntp = ntp_now;
+      reported = true;
+    }
+    return reported;
+  }
+
+  void processExtendedReport(uint32_t reporter, const uint8_t *p, size_t size, uint64_t ntp_now)
+  {
+    size_t pos = 0;
+    while (pos + 4 <= size)
+    {
+      uint8_t type = p[pos];
+      size_t length = (((p[pos + 2] << 8) | p[pos + 3]) + 1) * 4;
+      if (pos + length > size)
+        break;
+
+      if (type == RTCP_XR_RRTR && length == 12)
+      {
+        // NTP timestamp of the receiver, we answer with DLRR in the next SR
+        rrtr_ssrc_ = reporter;
+        rrtr_lrr_ = (get32(p + pos + 4) << 16) | (get32(p + pos + 8) >> 16);
+        rrtr_arrival_ = ntpCompact(ntp_now);
+      }
+      pos += length;
+    }
+  }
+};
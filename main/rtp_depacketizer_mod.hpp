@@ -0,0 +1,393 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <arpa/inet.h>
+
+#include "rtp_packetizer_mod.hpp"
+
+// Receive side of RTPPacketizer: an RTP jitter buffer plus an H.264
+// depacketizer that rebuilds Annex B access units. Standard library only, so
+// sender and receiver can run back to back in one process on a host.
+
+struct RTPPacketInfo
+{
+  uint16_t sequence;
+  uint32_t timestamp;
+  uint32_t ssrc;
+  uint8_t payload_type;
+  bool marker;
+  const uint8_t *payload;
+  size_t payload_size;
+};
+
+// Parses the fixed header, skipping CSRCs, header extension and padding
+inline bool parseRTPPacket(const uint8_t *data, size_t size, RTPPacketInfo &info)
+{
+  if (!data || size < RTP_HEADER_SIZE || (data[0] >> 6) != RTP_VERSION)
+    return false;
+
+  size_t header = RTP_HEADER_SIZE + (data[0] & 0x0F) * 4;
+  if (data[0] & 0x10)
+  {
+    if (size < header + 4)
+      return false;
+    header += 4 + ((data[header + 2] << 8) | data[header + 3]) * 4;
+  }
+
+  size_t padding = (data[0] & 0x20) ? data[size - 1] : 0;
+  if (size < header + padding)
+    return false;
+
+  info.marker = (data[1] & 0x80) != 0;
+  info.payload_type = data[1] & 0x7F;
+  info.sequence = static_cast<uint16_t>((data[2] << 8) | data[3]);
+  info.timestamp = (uint32_t(data[4]) << 24) | (uint32_t(data[5]) << 16) | (uint32_t(data[6]) << 8) | data[7];
+  info.ssrc = (uint32_t(data[8]) << 24) | (uint32_t(data[9]) << 16) | (uint32_t(data[10]) << 8) | data[11];
+  info.payload = data + header;
+  info.payload_size = size - header - padding;
+  return true;
+}
+
+// Defined outside the class to avoid initialization order issues
+struct RTPJitterBufferConfig
+{
+  size_t capacity = 512; // packets, bounds the reorder window
+  uint32_t latency_us = 20000;
+  uint16_t mtu = 1500;
+};
+
+// Reorders packets by sequence number. A missing packet is declared lost once
+// the packet after it has waited latency_us; the next delivered packet then
+// carries a discontinuity flag.
+class RTPJitterBuffer
+{
+public:
+  using Config = RTPJitterBufferConfig;
+
+  struct Stats
+  {
+    uint64_t received = 0;
+    uint64_t delivered = 0;
+    uint64_t lost = 0;
+    uint64_t reordered = 0;
+    uint64_t duplicates = 0;
+    uint64_t late = 0;
+    uint64_t resyncs = 0;
+  };
+
+  explicit RTPJitterBuffer(const Config &config = Config()) : config_(config), slots_(config.capacity)
+  {
+    for (auto &slot : slots_)
+      slot.data.reserve(config_.mtu);
+  }
+
+  // Copies the packet in, returns false if it was rejected
+  bool push(const uint8_t *data, size_t size, uint64_t arrival_us)
+  {
+    RTPPacketInfo info;
+    if (!parseRTPPacket(data, size, info))
+      return false;
+
+    stats_.received++;
+
+    if (!started_)
+    {
+      started_ = true;
+      next_seq_ = highest_seq_ = info.sequence;
+    }
+
+    int16_t ahead = static_cast<int16_t>(info.sequence - next_seq_);
+    if (ahead < 0)
+    {
+      stats_.late++;
+      return false;
+    }
+
+    // Sender jumped further than the window can hold: start over from here
+    if (static_cast<size_t>(ahead) >= slots_.size())
+    {
+      stats_.resyncs++;
+      stats_.lost += pending_;
+      for (auto &slot : slots_)
+        slot.used = false;
+      pending_ = 0;
+      next_seq_ = highest_seq_ = info.sequence;
+      discontinuity_ = true;
+    }
+
+    Slot &slot = slots_[info.sequence % slots_.size()];
+    if (slot.used && slot.sequence == info.sequence)
+    {
+      stats_.duplicates++;
+      return false;
+    }
+
+    if (static_cast<int16_t>(info.sequence - highest_seq_) < 0)
+      stats_.reordered++;
+    else
+      highest_seq_ = info.sequence;
+
+    slot.data.assign(data, data + size);
+    slot.sequence = info.sequence;
+    slot.arrival_us = arrival_us;
+    slot.used = true;
+    pending_++;
+    return true;
+  }
+
+  // deliver(const RTPPacketInfo &, bool discontinuity) for every packet that
+  // is next in order, or whose predecessors are given up on at now_us
+  template <typename Deliver>
+  void poll(uint64_t now_us, Deliver &&deliver)
+  {
+    while (pending_ > 0)
+    {
+      Slot &slot = slots_[next_seq_ % slots_.size()];
+      if (slot.used && slot.sequence == next_seq_)
+      {
+        deliverSlot(slot, deliver);
+        continue;
+      }
+
+      // Gap: skip it once the first packet waiting behind it is old enough
+      uint16_t seq = next_seq_;
+      Slot *waiting = nullptr;
+      while (static_cast<int16_t>(seq - highest_seq_) <= 0)
+      {
+        Slot &s = slots_[seq % slots_.size()];
+        if (s.used && s.sequence == seq)
+        {
+          waiting = &s;
+          break;
+        }
+        seq++;
+      }
+
+      if (!waiting || waiting->arrival_us + config_.latency_us > now_us)
+        break;
+
+      stats_.lost += static_cast<uint16_t>(seq - next_seq_);
+      next_seq_ = seq;
+      discontinuity_ = true;
+    }
+  }
+
+  // Delivers everything still buffered regardless of latency
+  template <typename Deliver>
+  void flush(Deliver &&deliver)
+  {
+    poll(UINT64_MAX - config_.latency_us, deliver);
+  }
+
+  size_t pending() const { return pending_; }
+  const Stats &stats() const { return stats_; }
+
+private:
+  struct Slot
+  {
+    std::vector<uint8_t> data;
+    uint64_t arrival_us = 0;
+    uint16_t sequence = 0;
+    bool used = false;
+  };
+
+  Config config_;
+  std::vector<Slot> slots_;
+  Stats stats_;
+  bool started_ = false;
+  bool discontinuity_ = false;
+  uint16_t next_seq_ = 0;
+  uint16_t highest_seq_ = 0;
+  size_t pending_ = 0;
+
+  template <typename Deliver>
+  void deliverSlot(Slot &slot, Deliver &deliver)
+  {
+    RTPPacketInfo info;
+    if (parseRTPPacket(slot.data.data(), slot.data.size(), info))
+    {
+      stats_.delivered++;
+      deliver(info, discontinuity_);
+      discontinuity_ = false;
+    }
+    slot.used = false;
+    pending_--;
+    next_seq_++;
+  }
+};
+
+// Rebuilds Annex B access units (4-byte start codes) from single NAL, STAP-A
+// and FU-A payloads. A frame ends on the marker bit or a timestamp change;
+// frames that saw a discontinuity or lost fragments are reported incomplete.
+class RTPDepacketizer
+{
+public:
+  struct AccessUnit
+  {
+    const uint8_t *data;
+    size_t size;
+    uint32_t timestamp;
+    bool keyframe;
+    bool complete;
+  };
+
+  struct Stats
+  {
+    uint64_t frames = 0;
+    uint64_t incomplete_frames = 0;
+    uint64_t nal_units = 0;
+    uint64_t dropped_fragments = 0;
+  };
+
+  explicit RTPDepacketizer(size_t max_frame_bytes = 512 * 1024)
+  {
+    frame_.reserve(max_frame_bytes);
+  }
+
+  // on_frame(const AccessUnit &) is called for every finished frame
+  template <typename OnFrame>
+  void push(const RTPPacketInfo &packet, bool discontinuity, OnFrame &&on_frame)
+  {
+    if (active_ && packet.timestamp != timestamp_)
+      finishFrame(false, on_frame);
+
+    if (discontinuity)
+    {
+      corrupt_ = true;
+      abortFragment();
+    }
+
+    active_ = true;
+    timestamp_ = packet.timestamp;
+
+    if (packet.payload_size > 0)
+      processPayload(packet.payload, packet.payload_size);
+
+    if (packet.marker)
+      finishFrame(true, on_frame);
+  }
+
+  // Emits a frame still being assembled, e.g. at the end of a stream
+  template <typename OnFrame>
+  void flush(OnFrame &&on_frame)
+  {
+    if (active_)
+      finishFrame(false, on_frame);
+  }
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  static constexpr uint8_t START_CODE[4] = {0x00, 0x00, 0x00, 0x01};
+
+  std::vector<uint8_t> frame_;
+  Stats stats_;
+  uint32_t timestamp_ = 0;
+  bool active_ = false;
+  bool corrupt_ = false;
+  bool keyframe_ = false;
+  bool in_fragment_ = false;
+  size_t fragment_start_ = 0;
+
+  void processPayload(const uint8_t *payload, size_t size)
+  {
+    uint8_t type = payload[0] & 0x1F;
+
+    if (type >= 1 && type <= 23)
+    {
+      appendNal(payload, size);
+    }
+    else if (type == H264_NAL_STAP_A)
+    {
+      size_t i = RTP_STAP_HEADER_SIZE;
+      while (i + RTP_STAP_LENGTH_SIZE <= size)
+      {
+        size_t nal_size = (payload[i] << 8) | payload[i + 1];
+        i += RTP_STAP_LENGTH_SIZE;
+        if (nal_size == 0 || i + nal_size > size)
+        {
+          corrupt_ = true;
+          break;
+        }
+        appendNal(payload + i, nal_size);
+        i += nal_size;
+      }
+    }
+    else if (type == H264_NAL_FU_A && size > RTP_FU_OVERHEAD)
+    {
+      processFragment(payload, size);
+    }
+  }
+
+  void processFragment(const uint8_t *payload, size_t size)
+  {
+    bool start = (payload[1] & 0x80) != 0;
+    bool end = (payload[1] & 0x40) != 0;
+
+    if (start)
+    {
+      abortFragment();
+      uint8_t nal_header = (payload[0] & 0xE0) | (payload[1] & 0x1F);
+      fragment_start_ = frame_.size();
+      frame_.insert(frame_.end(), START_CODE, START_CODE + sizeof(START_CODE));
+      frame_.push_back(nal_header);
+      in_fragment_ = true;
+      keyframe_ |= (nal_header & 0x1F) == 5;
+    }
+    else if (!in_fragment_)
+    {
+      // Middle or end without its start fragment
+      stats_.dropped_fragments++;
+      corrupt_ = true;
+      return;
+    }
+
+    frame_.insert(frame_.end(), payload + RTP_FU_OVERHEAD, payload + size);
+
+    if (end)
+    {
+      in_fragment_ = false;
+      stats_.nal_units++;
+    }
+  }
+
+  void abortFragment()
+  {
+    if (!in_fragment_)
+      return;
+    frame_.resize(fragment_start_);
+    in_fragment_ = false;
+    stats_.dropped_fragments++;
+    corrupt_ = true;
+  }
+
+  void appendNal(const uint8_t *nal, size_t size)
+  {
+    abortFragment();
+    frame_.insert(frame_.end(), START_CODE, START_CODE + sizeof(START_CODE));
+    frame_.insert(frame_.end(), nal, nal + size);
+    keyframe_ |= (nal[0] & 0x1F) == 5;
+    stats_.nal_units++;
+  }
+
+  template <typename OnFrame>
+  void finishFrame(bool marker, OnFrame &on_frame)
+  {
+    abortFragment();
+
+    AccessUnit au{frame_.data(), frame_.size(), timestamp_, keyframe_, marker && !corrupt_};
+    stats_.frames++;
+    if (!au.complete)
+      stats_.incomplete_frames++;
+    if (au.size > 0)
+      on_frame(au);
+
+    frame_.clear();
+    active_ = false;
+    corrupt_ = false;
+    keyframe_ = false;
+  }
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "rtp_packetizer_mod.hpp"
+
+// RFC 5109 ULPFEC-style XOR parity. Each FEC packet protects a group of up to
+// 16 consecutive media packets (level 0, 16-bit mask) and can rebuild any one
+// of them. FEC travels as a separate RTP stream (own SSRC and sequence
+// numbers, payload type RTP_PAYLOAD_FEC) on the media port.
+
+static constexpr uint8_t RTP_PAYLOAD_FEC = 127;
+static constexpr size_t RTP_FEC_HEADER_SIZE = 10;
+static constexpr size_t RTP_FEC_LEVEL_HEADER_SIZE = 4; // protection length + 16-bit mask
+static constexpr size_t RTP_FEC_MAX_GROUP = 16;
+
+class RTPFecEncoder
+{
+public:
+  // FEC packet to be sent right after media packet number `after` of the frame
+  struct FecPacket
+  {
+    RTPPacketView view;
+    size_t after;
+  };
+
+  RTPFecEncoder(uint32_t ssrc, uint16_t mtu = RTP_DEFAULT_MTU, size_t max_frame_bytes = 0,
+                RTPPacketArena::AllocFn alloc = std::malloc, RTPPacketArena::FreeFn release = std::free)
+      : ssrc_(ssrc), arena_(0, mtu, alloc, release)
+  {
+    // A group of one packet carries as much parity as media, plus the FEC
+    // headers on every packet
+    size_t max_packets = max_frame_bytes / mtu + 16;
+    arena_.reserve(max_frame_bytes + max_packets * (RTP_FEC_HEADER_SIZE + RTP_FEC_LEVEL_HEADER_SIZE), mtu);
+    after_.reserve(max_frame_bytes / mtu + 16);
+  }
+
+  // group: media packets per FEC packet for P-frames, key_group for IDR
+  // frames; 0 disables FEC for that frame type. Safe to call while streaming.
+  void configure(uint8_t group, uint8_t key_group)
+  {
+    group_.store(std::min<size_t>(group, RTP_FEC_MAX_GROUP));
+    key_group_.store(std::min<size_t>(key_group, RTP_FEC_MAX_GROUP));
+  }
+
+  uint8_t group() const { return group_.load(); }
+  uint8_t keyGroup() const { return key_group_.load(); }
+  bool enabled() const { return group_.load() > 0 || key_group_.load() > 0; }
+
+  // Builds the FEC packets for one packetized frame. Parameter-set packets
+  // (SPS/PPS or a STAP-A) form their own group so they are recoverable
+  // independently of the large slice packets around them.
+  size_t protectFrame(const RTPDescriptorList &media, bool keyframe)
+  {
+    arena_.clear();
+    after_.clear();
+
+    size_t k = keyframe ? key_group_.load() : group_.load();
+    if (k == 0 || media.empty())
+      return 0;
+
+    size_t begin = 0;
+    bool group_params = isParameterPacket(media[0]);
+    for (size_t i = 1; i <= media.size(); i++)
+    {
+      bool params = i < media.size() && isParameterPacket(media[i]);
+      if (i == media.size() || i - begin == k || params != group_params)
+      {
+        protectGroup(media, begin, i);
+        begin = i;
+        group_params = params;
+      }
+    }
+    return arena_.size();
+  }
+
+  size_t size() const { return arena_.size(); }
+  // Views are only valid until the next protectFrame()
+  FecPacket operator[](size_t i) const { return {arena_[i], after_[i]}; }
+  const RTPPacketArena &arena() const { return arena_; }
+
+private:
+  uint32_t ssrc_;
+  uint16_t sequence_number_ = 0;
+  std::atomic<uint8_t> group_{0};
+  std::atomic<uint8_t> key_group_{0};
+  RTPPacketArena arena_;
+  std::vector<size_t> after_;
+
+  static bool isParameterPacket(const RTPPacketDescriptor &d)
+  {
+    uint8_t type = d.nalType();
+    return type == 7 || type == 8 || type == H264_NAL_STAP_A;
+  }
+
+  // Media packet bytes after the fixed RTP header
+  static size_t protectedSize(const RTPPacketDescriptor &d) { return d.size() - RTP_HEADER_SIZE; }
+
+  void protectGroup(const RTPDescriptorList &media, size_t begin, size_t end)
+  {
+    size_t protection_length = 0;
+    for (size_t i = begin; i < end; i++)
+      protection_length = std::max(protection_length, protectedSize(media[i]));
+
+    const size_t header = RTP_HEADER_SIZE + RTP_FEC_HEADER_SIZE + RTP_FEC_LEVEL_HEADER_SIZE;
+    uint8_t *packet = arena_.allocate(header + protection_length);
+    if (!packet)
+      return;
+    memset(packet, 0, header + protection_length);
+
+    const RTPPacketDescriptor &first = media[begin];
+    uint16_t sn_base = static_cast<uint16_t>((first.header[2] << 8) | first.header[3]);
+
+    uint8_t *fec = packet + RTP_HEADER_SIZE;
+    uint8_t *level = fec + RTP_FEC_HEADER_SIZE;
+    uint8_t *payload = level + RTP_FEC_LEVEL_HEADER_SIZE;
+    uint16_t length_recovery = 0;
+    uint16_t mask = 0;
+
+    for (size_t i = begin; i < end; i++)
+    {
+      const RTPPacketDescriptor &d = media[i];
+
+      fec[0] ^= d.header[0];
+      fec[1] ^= d.header[1];
+      for (int b = 4; b < 8; b++)
+        fec[b] ^= d.header[b]; // timestamp recovery
+      length_recovery ^= static_cast<uint16_t>(protectedSize(d));
+      mask |= 0x8000 >> (i - begin);
+
+      // Header tail (FU indicator/header) followed by the payload span
+      size_t tail = d.header_size - RTP_HEADER_SIZE;
+      xorInto(payload, d.header + RTP_HEADER_SIZE, tail);
+      xorInto(payload + tail, d.payload, d.payload_size);
+    }
+
+    fec[0] &= 0x3F; // E = 0, L = 0 (16-bit mask)
+    fec[2] = static_cast<uint8_t>(sn_base >> 8);
+    fec[3] = static_cast<uint8_t>(sn_base & 0xFF);
+    fec[8] = static_cast<uint8_t>(length_recovery >> 8);
+    fec[9] = static_cast<uint8_t>(length_recovery & 0xFF);
+    level[0] = static_cast<uint8_t>(protection_length >> 8);
+    level[1] = static_cast<uint8_t>(protection_length & 0xFF);
+    level[2] = static_cast<uint8_t>(mask >> 8);
+    level[3] = static_cast<uint8_t>(mask & 0xFF);
+
+    // Own stream: same timestamp as the frame, own sequence space
+    auto *h = reinterpret_cast<RTPHeader *>(packet);
+    h->version_padding_cc = RTP_VERSION << 6;
+    h->marker_payload_type = RTP_PAYLOAD_FEC;
+    h->sequence_number = htons(sequence_number_++);
+    memcpy(&h->timestamp, first.header + 4, sizeof(h->timestamp));
+    h->ssrc = htonl(ssrc_);
+
+    after_.push_back(end - 1);
+  }
+
+  static void xorInto(uint8_t *dst, const uint8_t *src, size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+      dst[i] ^= src[i];
+  }
+};
+
+// Receive side: remembers recent media packets and rebuilds a single missing
+// packet of a group from its FEC packet. Standard library only, intended for
+// host loopback runs.
+class RTPFecDecoder
+{
+public:
+  struct Stats
+  {
+    uint64_t fec_packets = 0;
+    uint64_t recovered = 0;
+    uint64_t unrecoverable = 0;
+  };
+
+  explicit RTPFecDecoder(uint8_t fec_payload_type = RTP_PAYLOAD_FEC, size_t history = 1024, size_t max_pending = 32)
+      : fec_payload_type_(fec_payload_type), history_(history), pending_(max_pending)
+  {
+  }
+
+  // Returns true if the packet was FEC and consumed here. on_recovered(data,
+  // size) receives every media packet rebuilt as a result of this packet.
+  template <typename OnRecovered>
+  bool push(const uint8_t *data, size_t size, OnRecovered &&on_recovered)
+  {
+    if (size < RTP_HEADER_SIZE)
+      return false;
+
+    if ((data[1] & 0x7F) == fec_payload_type_)
+    {
+      if (size < RTP_HEADER_SIZE + RTP_FEC_HEADER_SIZE + RTP_FEC_LEVEL_HEADER_SIZE)
+        return true;
+
+      stats_.fec_packets++;
+      Fec &slot = pending_[next_pending_++ % pending_.size()];
+      if (slot.used)
+        stats_.unrecoverable++; // evicted with packets still missing
+      slot.data.assign(data, data + size);
+      slot.used = true;
+      tryRecover(slot, on_recovered);
+      return true;
+    }
+
+    media_ssrc_ = (uint32_t(data[8]) << 24) | (uint32_t(data[9]) << 16) | (uint32_t(data[10]) << 8) | data[11];
+    store(data, size);
+
+    // A late media packet may leave a group with a single gap
+    for (auto &fec : pending_)
+    {
+      if (fec.used)
+        tryRecover(fec, on_recovered);
+    }
+    return false;
+  }
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  struct Media
+  {
+    std::vector<uint8_t> data;
+    uint16_t sequence = 0;
+    bool used = false;
+  };
+
+  struct Fec
+  {
+    std::vector<uint8_t> data;
+    bool used = false;
+  };
+
+  uint8_t fec_payload_type_;
+  uint32_t media_ssrc_ = 0;
+  std::vector<Media> history_;
+  std::vector<Fec> pending_;
+  size_t next_pending_ = 0;
+  std::vector<uint8_t> scratch_;
+  Stats stats_;
+
+  static uint16_t sequenceOf(const uint8_t *data) { return static_cast<uint16_t>((data[2] << 8) | data[3]); }
+
+  void store(const uint8_t *data, size_t size)
+  {
+    uint16_t seq = sequenceOf(data);
+    Media &m = history_[seq % history_.size()];
+    m.data.assign(data, data + size);
+    m.sequence = seq;
+    m.used = true;
+  }
+
+  const Media *find(uint16_t seq) const
+  {
+    const Media &m = history_[seq % history_.size()];
+    return (m.used && m.sequence == seq) ? &m : nullptr;
+  }
+
+  template <typename OnRecovered>
+  void tryRecover(Fec &slot, OnRecovered &on_recovered)
+  {
+    const uint8_t *fec = slot.data.data() + RTP_HEADER_SIZE;
+    const uint8_t *level = fec + RTP_FEC_HEADER_SIZE;
+    const uint8_t *fec_payload = level + RTP_FEC_LEVEL_HEADER_SIZE;
+    size_t fec_payload_size = slot.data.size() - (fec_payload - slot.data.data());
+
+    uint16_t sn_base = static_cast<uint16_t>((fec[2] << 8) | fec[3]);
+    size_t protection_length = (level[0] << 8) | level[1];
+    uint16_t mask = static_cast<uint16_t>((level[2] << 8) | level[3]);
+    if (protection_length > fec_payload_size)
+    {
+      slot.used = false;
+      return;
+    }
+
+    int missing = 0;
+    uint16_t missing_seq = 0;
+    for (int bit = 0; bit < 16; bit++)
+    {
+      uint16_t seq = static_cast<uint16_t>(sn_base + bit);
+      if ((mask & (0x8000 >> bit)) && !find(seq))
+      {
+        missing++;
+        missing_seq = seq;
+      }
+    }
+
+    if (missing == 0)
+    {
+      slot.used = false;
+      return;
+    }
+    if (missing > 1)
+      return;
+
+    // XOR the FEC packet with every present packet of the group
+    uint8_t b0 = fec[0], b1 = fec[1];
+    uint8_t ts[4] = {fec[4], fec[5], fec[6], fec[7]};
+    uint16_t length = static_cast<uint16_t>((fec[8] << 8) | fec[9]);
+    scratch_.assign(RTP_HEADER_SIZE + protection_length, 0);
+    uint8_t *payload = scratch_.data() + RTP_HEADER_SIZE;
+    memcpy(payload, fec_payload, protection_length);
+
+    for (int bit = 0; bit < 16; bit++)
+    {
+      uint16_t seq = static_cast<uint16_t>(sn_base + bit);
+      if (!(mask & (0x8000 >> bit)) || seq == missing_seq)
+        continue;
+
+      const Media *m = find(seq);
+      const uint8_t *d = m->data.data();
+      size_t protected_size = m->data.size() - RTP_HEADER_SIZE;
+      b0 ^= d[0];
+      b1 ^= d[1];
+      for (int b = 0; b < 4; b++)
+        ts[b] ^= d[4 + b];
+      length ^= static_cast<uint16_t>(protected_size);
+      for (size_t i = 0; i < std::min(protected_size, protection_length); i++)
+        payload[i] ^= d[RTP_HEADER_SIZE + i];
+    }
+
+    slot.used = false;
+    if (length > protection_length)
+    {
+      stats_.unrecoverable++;
+      return;
+    }
+
+    uint8_t *h = scratch_.data();
+    h[0] = static_cast<uint8_t>((RTP_VERSION << 6) | (b0 & 0x3F));
+    h[1] = b1;
+    h[2] = static_cast<uint8_t>(missing_seq >> 8);
+    h[3] = static_cast<uint8_t>(missing_seq & 0xFF);
+    memcpy(h + 4, ts, sizeof(ts));
+    h[8] = static_cast<uint8_t>(media_ssrc_ >> 24);
+    h[9] = static_cast<uint8_t>(media_ssrc_ >> 16);
+    h[10] = static_cast<uint8_t>(media_ssrc_ >> 8);
+    h[11] = static_cast<uint8_t>(media_ssrc_);
+
+    size_t size = RTP_HEADER_SIZE + length;
+    stats_.recovered++;
+    store(h, size);
+    on_recovered(static_cast<const uint8_t *>(h), size);
+  }
+};
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "rtp_packetizer_mod.hpp"
+
+// RFC 2435 RTP/JPEG. Only the entropy-coded scan of a baseline JFIF frame is
+// sent; the receiver rebuilds the JPEG headers from the 8-byte RTP/JPEG
+// header, the quantization tables sent in-band (Q = 255) and the standard
+// Huffman tables, which the encoder has to use. Standard library only.
+
+static constexpr uint8_t RTP_PAYLOAD_JPEG = 26; // static payload type
+static constexpr size_t RTP_JPEG_HEADER_SIZE = 8;
+static constexpr size_t RTP_JPEG_RESTART_HEADER_SIZE = 4;
+static constexpr size_t RTP_JPEG_QTABLE_HEADER_SIZE = 4;
+static constexpr uint8_t RTP_JPEG_Q_DYNAMIC = 255;
+static constexpr uint8_t RTP_JPEG_TYPE_RESTART = 64;
+static constexpr uint16_t RTP_JPEG_MAX_DIMENSION = 2040; // 8 bits of 8 pixel blocks
+
+// What the RTP/JPEG header needs from a JFIF frame
+struct JpegFrameInfo
+{
+  uint8_t type = 0; // 0 = 4:2:2, 1 = 4:2:0, + 64 with restart markers
+  uint16_t width = 0;
+  uint16_t height = 0;
+  uint16_t restart_interval = 0;
+  const uint8_t *qtables[2] = {nullptr, nullptr}; // luma, chroma; 64 bytes each
+  const uint8_t *scan = nullptr;                  // entropy-coded data up to EOI
+  size_t scan_size = 0;
+};
+
+// Walks the marker segments up to the start of scan. Returns false for
+// anything RFC 2435 cannot describe: progressive or 12-bit frames, 16-bit
+// quantization tables, grayscale or sampling other than 4:2:2 / 4:2:0.
+inline bool parseJpeg(const uint8_t *data, size_t size, JpegFrameInfo &info)
+{
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return false;
+
+  const uint8_t *tables[4] = {nullptr, nullptr, nullptr, nullptr};
+  uint8_t luma_table = 0, chroma_table = 0;
+  bool have_frame = false;
+  size_t pos = 2;
+
+  while (pos + 4 <= size)
+  {
+    if (data[pos] != 0xFF)
+      return false;
+    uint8_t marker = data[pos + 1];
+    if (marker == 0xFF)
+    {
+      pos++; // fill byte
+      continue;
+    }
+
+    size_t length = (data[pos + 2] << 8) | data[pos + 3];
+    const uint8_t *segment = data + pos + 4;
+    if (length < 2 || pos + 2 + length > size)
+      return false;
+    size_t segment_size = length - 2;
+
+    switch (marker)
+    {
+    case 0xDB: // DQT, one or more tables
+      for (size_t i = 0; i + 65 <= segment_size; i += 65)
+      {
+        if ((segment[i] >> 4) != 0)
+          return false; // 16-bit precision
+        tables[segment[i] & 0x03] = segment + i + 1;
+      }
+      break;
+
+    case 0xC0: // SOF0, baseline
+    {
+      if (segment_size < 15 || segment[0] != 8 || segment[5] != 3)
+        return false;
+      info.height = static_cast<uint16_t>((segment[1] << 8) | segment[2]);
+      info.width = static_cast<uint16_t>((segment[3] << 8) | segment[4]);
+
+      // Y sampled 2x1 or 2x2, Cb and Cr 1x1 with a shared table
+      uint8_t y = segment[7];
+      if (y == 0x21)
+        info.type = 0;
+      else if (y == 0x22)
+        info.type = 1;
+      else
+        return false;
+      if (segment[10] != 0x11 || segment[13] != 0x11 || segment[11] != segment[14])
+        return false;
+      luma_table = segment[8] & 0x03;
+      chroma_table = segment[11] & 0x03;
+      have_frame = true;
+      break;
+    }
+
+    case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+    case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+      return false; // not baseline
+
+    case 0xDD: // DRI
+      if (segment_size >= 2)
+        info.restart_interval = static_cast<uint16_t>((segment[0] << 8) | segment[1]);
+      break;
+
+    case 0xDA: // SOS, the scan runs to EOI
+    {
+      if (!have_frame || !tables[luma_table] || !tables[chroma_table])
+        return false;
+      if (info.width == 0 || info.height == 0 ||
+          info.width > RTP_JPEG_MAX_DIMENSION || info.height > RTP_JPEG_MAX_DIMENSION)
+        return false;
+
+      const uint8_t *scan = segment + segment_size;
+      const uint8_t *end = data + size;
+      // Trailing padding after EOI is common in encoder buffers
+      for (const uint8_t *p = end - 2; p >= scan; p--)
+      {
+        if (p[0] == 0xFF && p[1] == 0xD9)
+        {
+          end = p;
+          break;
+        }
+      }
+
+      if (info.restart_interval)
+        info.type |= RTP_JPEG_TYPE_RESTART;
+      info.qtables[0] = tables[luma_table];
+      info.qtables[1] = tables[chroma_table];
+      info.scan = scan;
+      info.scan_size = end - scan;
+      return info.scan_size > 0;
+    }
+
+    default:
+      break;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+class RTPJpegPacketizer
+{
+public:
+  RTPJpegPacketizer(uint32_t ssrc = 0x12345678, uint16_t mtu = RTP_DEFAULT_MTU)
+      : ssrc_(ssrc), mtu_(mtu), first_payload_(mtu)
+  {
+  }
+
+  // Same contract as RTPPacketizer's descriptor variant: the payload spans
+  // point into data, except for the first packet, whose quantization tables
+  // and leading scan bytes are copied into the list. Returns 0 for frames
+  // that are not RFC 2435 compatible.
+  size_t packetize(const uint8_t *data, size_t size, uint64_t timestamp_us, RTPDescriptorList &descriptors)
+  {
+    descriptors.clear();
+    JpegFrameInfo info;
+    if (!data || !parseJpeg(data, size, info))
+    {
+      rejected_frames_++;
+      return 0;
+    }
+
+    bool extensions = extensions_;
+    size_t rtp_header = RTP_HEADER_SIZE + (extensions ? RTP_EXTENSIONS_SIZE : 0);
+    size_t header = rtp_header + RTP_JPEG_HEADER_SIZE +
+                    ((info.type & RTP_JPEG_TYPE_RESTART) ? RTP_JPEG_RESTART_HEADER_SIZE : 0);
+    const size_t tables = RTP_JPEG_QTABLE_HEADER_SIZE + 2 * 64;
+    if (mtu_ <= header + tables)
+      return 0;
+    size_t max_payload = mtu_ - header;
+
+    uint32_t ts = RTPPacketizer::rtpTimestamp(timestamp_us);
+    timestamp_ = (ts != timestamp_) ? ts : timestamp_ + 1;
+
+    size_t offset = 0;
+    while (offset < info.scan_size)
+    {
+      size_t room = offset == 0 ? max_payload - tables : max_payload;
+      size_t chunk = std::min(room, info.scan_size - offset);
+      bool last = offset + chunk == info.scan_size;
+
+      const uint8_t *payload = info.scan + offset;
+      size_t payload_size = chunk;
+      if (offset == 0)
+      {
+        // Quantization table header + luma and chroma tables lead the frame
+        uint8_t *p = first_payload_.data();
+        p[0] = 0;
+        p[1] = 0; // 8-bit precision
+        p[2] = 0;
+        p[3] = 2 * 64;
+        memcpy(p + RTP_JPEG_QTABLE_HEADER_SIZE, info.qtables[0], 64);
+        memcpy(p + RTP_JPEG_QTABLE_HEADER_SIZE + 64, info.qtables[1], 64);
+        memcpy(p + tables, info.scan, chunk);
+        payload = descriptors.store(p, tables + chunk);
+        payload_size = tables + chunk;
+        if (!payload)
+          break;
+      }
+
+      RTPPacketDescriptor *d = descriptors.allocate();
+      if (!d)
+        break;
+      writeHeaders(d->header, extensions, last, offset, info);
+      d->header_size = static_cast<uint8_t>(header);
+      d->payload = payload;
+      d->payload_size = payload_size;
+      offset += chunk;
+    }
+    return descriptors.size();
+  }
+
+  // Reserves the same send-time extensions as RTPPacketizer
+  void setHeaderExtensions(bool enabled) { extensions_ = enabled; }
+  bool headerExtensions() const { return extensions_; }
+
+  uint16_t sequenceNumber() const { return sequence_number_; }
+  void setSequenceNumber(uint16_t sequence_number) { sequence_number_ = sequence_number; }
+  uint32_t rejectedFrames() const { return rejected_frames_; }
+
+private:
+  uint32_t ssrc_;
+  uint16_t mtu_;
+  uint16_t sequence_number_ = 0;
+  uint32_t timestamp_ = 0;
+  bool extensions_ = false;
+  uint32_t rejected_frames_ = 0;
+  std::vector<uint8_t> first_payload_;
+
+  void writeHeaders(uint8_t *buf, bool extensions, bool marker, size_t offset, const JpegFrameInfo &info)
+  {
+    auto *h = reinterpret_cast<RTPHeader *>(buf);
+    h->version_padding_cc = (RTP_VERSION << 6) | (extensions ? 0x10 : 0x00);
+    h->marker_payload_type = (marker ? 0x80 : 0x00) | RTP_PAYLOAD_JPEG;
+    h->sequence_number = htons(sequence_number_++);
+    h->timestamp = htonl(timestamp_);
+    h->ssrc = htonl(ssrc_);
+
+    uint8_t *p = buf + RTP_HEADER_SIZE;
+    if (extensions)
+    {
+      memcpy(p, RTP_EXTENSIONS_TEMPLATE, sizeof(RTP_EXTENSIONS_TEMPLATE));
+      p += RTP_EXTENSIONS_SIZE;
+    }
+
+    p[0] = 0; // type-specific: progressive frame
+    p[1] = static_cast<uint8_t>(offset >> 16);
+    p[2] = static_cast<uint8_t>(offset >> 8);
+    p[3] = static_cast<uint8_t>(offset);
+    p[4] = info.type;
+    p[5] = RTP_JPEG_Q_DYNAMIC;
+    p[6] = static_cast<uint8_t>((info.width + 7) / 8);
+    p[7] = static_cast<uint8_t>((info.height + 7) / 8);
+
+    if (info.type & RTP_JPEG_TYPE_RESTART)
+    {
+      // Packets are not aligned to restart intervals: F = L = 1, count 0x3FFF
+      p[8] = static_cast<uint8_t>(info.restart_interval >> 8);
+      p[9] = static_cast<uint8_t>(info.restart_interval);
+      p[10] = 0xFF;
+      p[11] = 0xFF;
+    }
+  }
+};
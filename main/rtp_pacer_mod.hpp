@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+// Defined outside the class to avoid initialization order issues
+struct PacketPacerConfig
+{
+  // Share of the frame interval a large frame is spread over, 0 disables pacing
+  uint8_t window_percent = 50;
+  // Sent back to back; frames up to this size are not paced at all
+  uint32_t burst_bytes = 16 * 1024;
+  // Starting estimate, then tracked from the actual frame cadence
+  uint32_t frame_interval_us = 33333;
+  // Waits shorter than this are not worth a timer round trip
+  uint32_t min_wait_us = 300;
+};
+
+// Leaky-bucket pacer for one frame at a time. The first burst_bytes of a frame
+// leave immediately, the rest drains at the rate that finishes the frame
+// within window_percent of the frame interval, so an IDR does not flood the
+// Wi-Fi TX queue while small P-frames are not delayed.
+class PacketPacer
+{
+public:
+  using Config = PacketPacerConfig;
+
+  struct Stats
+  {
+    uint32_t frames = 0;
+    uint32_t paced_frames = 0;
+    uint32_t packets = 0;
+    uint32_t drops = 0;
+    uint64_t queue_delay_sum_us = 0; // packet send time minus frame ready time
+    uint32_t queue_delay_max_us = 0;
+    uint32_t frame_interval_us = 0;
+  };
+
+  explicit PacketPacer(const Config &config = Config())
+      : window_percent_(config.window_percent), burst_bytes_(config.burst_bytes),
+        frame_interval_us_(config.frame_interval_us), min_wait_us_(config.min_wait_us)
+  {
+    esp_timer_create_args_t args = {};
+    args.callback = onTimer;
+    args.arg = this;
+    args.name = "rtp_pacer";
+    if (esp_timer_create(&args, &timer_) != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Failed to create pacing timer, pacing disabled");
+      timer_ = nullptr;
+    }
+  }
+
+  ~PacketPacer()
+  {
+    if (timer_)
+    {
+      esp_timer_stop(timer_);
+      esp_timer_delete(timer_);
+    }
+  }
+
+  PacketPacer(const PacketPacer &) = delete;
+  PacketPacer &operator=(const PacketPacer &) = delete;
+
+  // Safe to call from another task while streaming
+  void configure(uint8_t window_percent, uint32_t burst_bytes)
+  {
+    window_percent_.store(std::min<uint8_t>(window_percent, 100));
+    burst_bytes_.store(burst_bytes);
+  }
+
+  uint8_t windowPercent() const { return window_percent_.load(); }
+  uint32_t burstBytes() const { return burst_bytes_.load(); }
+
+  // Call once per frame after packetization, before the first packet is sent
+  void beginFrame(size_t frame_bytes)
+  {
+    int64_t now = esp_timer_get_time();
+
+    // Track the frame cadence, ignoring pauses such as a stopped stream
+    if (last_frame_us_ > 0)
+    {
+      int64_t interval = now - last_frame_us_;
+      if (interval > 5000 && interval < 200000)
+        frame_interval_us_ = (frame_interval_us_ * 7 + static_cast<uint32_t>(interval)) / 8;
+    }
+    last_frame_us_ = now;
+    if (frame_interval_us_ > 0)
+      backlog_percent_ = static_cast<uint32_t>(static_cast<uint64_t>(frame_delay_us_) * 100 / frame_interval_us_);
+    frame_delay_us_ = 0;
+
+    frame_start_us_ = now;
+    burst_ = burst_bytes_.load();
+    paced_bytes_ = frame_bytes > burst_ ? frame_bytes - burst_ : 0;
+    window_us_ = static_cast<uint64_t>(frame_interval_us_) * window_percent_.load() / 100;
+
+    stats_.frames++;
+    if (paced_bytes_ > 0 && window_us_ > 0 && timer_)
+      stats_.paced_frames++;
+  }
+
+  // Blocks until the packet starting at byte offset sent_bytes of the frame
+  // may leave
+  void waitForSlot(size_t sent_bytes)
+  {
+    int64_t wait = waitTime(sent_bytes);
+    if (wait < min_wait_us_)
+      return;
+
+    // The task may also be notified for other reasons (a queued frame), so
+    // only the timer firing ends the wait
+    waiting_task_ = xTaskGetCurrentTaskHandle();
+    if (esp_timer_start_once(timer_, wait) != ESP_OK)
+      return;
+    TickType_t timeout = pdMS_TO_TICKS(wait / 1000 + 20);
+    while (ulTaskNotifyTake(pdTRUE, timeout) > 0 && esp_timer_is_active(timer_))
+    {
+    }
+    esp_timer_stop(timer_); // timed out: the next wait must be able to start it
+  }
+
+  // True if the packet starting at sent_bytes may leave without waiting, so
+  // everything due can be sent as one batch
+  bool slotOpen(size_t sent_bytes) const { return waitTime(sent_bytes) < min_wait_us_; }
+
+  void packetSent(bool ok)
+  {
+    uint32_t delay = static_cast<uint32_t>(esp_timer_get_time() - frame_start_us_);
+    stats_.packets++;
+    stats_.queue_delay_sum_us += delay;
+    stats_.queue_delay_max_us = std::max(stats_.queue_delay_max_us, delay);
+    frame_delay_us_ = delay;
+    if (!ok)
+      stats_.drops++;
+  }
+
+  // How long the previous frame took to send, in percent of the frame
+  // interval; above 100 the link does not keep up with the encoder
+  uint32_t backlogPercent() const { return backlog_percent_.load(); }
+
+  // Returns the counters since the previous call and starts a new period
+  Stats takeStats()
+  {
+    Stats s = stats_;
+    s.frame_interval_us = frame_interval_us_;
+    stats_ = {};
+    return s;
+  }
+
+private:
+  static constexpr const char *TAG = "RTP_PACER";
+
+  std::atomic<uint8_t> window_percent_;
+  std::atomic<uint32_t> burst_bytes_;
+  uint32_t frame_interval_us_;
+  uint32_t min_wait_us_;
+
+  esp_timer_handle_t timer_ = nullptr;
+  TaskHandle_t waiting_task_ = nullptr;
+
+  int64_t last_frame_us_ = 0;
+  int64_t frame_start_us_ = 0;
+  size_t burst_ = 0;
+  size_t paced_bytes_ = 0;
+  uint64_t window_us_ = 0;
+  uint32_t frame_delay_us_ = 0; // last packet of the current frame
+  std::atomic<uint32_t> backlog_percent_{0};
+  Stats stats_;
+
+  int64_t waitTime(size_t sent_bytes) const
+  {
+    if (sent_bytes <= burst_ || paced_bytes_ == 0 || window_us_ == 0 || !timer_)
+      return 0;
+
+    int64_t due = frame_start_us_ + static_cast<int64_t>((sent_bytes - burst_) * window_us_ / paced_bytes_);
+    return due - esp_timer_get_time();
+  }
+
+  static void onTimer(void *arg)
+  {
+    auto *self = static_cast<PacketPacer *>(arg);
+    if (self->waiting_task_)
+      xTaskNotifyGive(self->waiting_task_);
+  }
+};
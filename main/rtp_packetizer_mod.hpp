@@ -2,6 +2,7 @@
 
 #include <cstring>
 #include <cstdint>
+#include <cstdlib>
 #include <vector>
 #include <algorithm>
 #include <arpa/inet.h>
@@ -11,6 +12,29 @@ static constexpr uint8_t RTP_PAYLOAD_H264 = 96;
 static constexpr uint16_t RTP_DEFAULT_MTU = 1400;
 static constexpr uint32_t RTP_CLOCK_RATE = 90000;
 static constexpr size_t RTP_HEADER_SIZE = 12;
+static constexpr size_t RTP_FU_OVERHEAD = 2; // FU indicator + FU header
+static constexpr size_t RTP_STAP_HEADER_SIZE = 1;
+static constexpr size_t RTP_STAP_LENGTH_SIZE = 2;
+static constexpr uint8_t H264_NAL_STAP_A = 24;
+static constexpr uint8_t H264_NAL_FU_A = 28;
+
+// RFC 8285 one-byte header extensions, reserved by the packetizer and filled
+// in just before sending: abs-send-time (6.18 fixed point seconds) and the
+// transport-wide sequence number used for delay-based bandwidth estimation.
+static constexpr uint16_t RTP_EXTENSION_ONE_BYTE = 0xBEDE;
+static constexpr uint8_t RTP_EXT_ABS_SEND_TIME_ID = 3;
+static constexpr uint8_t RTP_EXT_TRANSPORT_SEQ_ID = 5;
+// 0xBEDE + length, abs-send-time (1 + 3), transport seq (1 + 2), 1 byte padding
+static constexpr size_t RTP_EXTENSIONS_SIZE = 12;
+// Extension block with zeroed values, see stampHeaderExtensions()
+static constexpr uint8_t RTP_EXTENSIONS_TEMPLATE[RTP_EXTENSIONS_SIZE] = {
+    RTP_EXTENSION_ONE_BYTE >> 8, RTP_EXTENSION_ONE_BYTE & 0xFF, 0, 2,
+    (RTP_EXT_ABS_SEND_TIME_ID << 4) | 2, 0, 0, 0,
+    (RTP_EXT_TRANSPORT_SEQ_ID << 4) | 1, 0, 0, 0};
+
+// Largest payload header kept with the RTP header: FU indicator + FU header
+// for H.264, main + restart marker header for RTP/JPEG
+static constexpr size_t RTP_PAYLOAD_HEADER_MAX_SIZE = 12;
 
 struct __attribute__((packed)) RTPHeader
 {
@@ -21,12 +45,361 @@ struct __attribute__((packed)) RTPHeader
   uint32_t ssrc;
 };
 
+// Non-owning reference to a packet stored in an RTPPacketArena
+struct RTPPacketView
+{
+  const uint8_t *data;
+  size_t size;
+};
+
+// Reusable packet storage for one frame. Reserve it once for the worst-case
+// frame and the steady-state packetize path performs no heap allocations;
+// every growth beyond the reservation is counted so that can be verified.
+class RTPPacketArena
+{
+public:
+  using AllocFn = void *(*)(size_t);
+  using FreeFn = void (*)(void *);
+
+  RTPPacketArena(size_t max_frame_bytes = 0, uint16_t mtu = RTP_DEFAULT_MTU,
+                 AllocFn alloc = std::malloc, FreeFn release = std::free)
+      : alloc_(alloc), free_(release)
+  {
+    reserve(max_frame_bytes, mtu);
+  }
+
+  ~RTPPacketArena()
+  {
+    free_(storage_);
+    free_(views_);
+  }
+
+  RTPPacketArena(const RTPPacketArena &) = delete;
+  RTPPacketArena &operator=(const RTPPacketArena &) = delete;
+
+  // Sizes storage for a frame of max_frame_bytes Annex B data. Not counted as
+  // a frame allocation, call it once during setup.
+  bool reserve(size_t max_frame_bytes, uint16_t mtu = RTP_DEFAULT_MTU)
+  {
+    size_t payload = mtu > RTP_HEADER_SIZE + RTP_FU_OVERHEAD ? mtu - RTP_HEADER_SIZE - RTP_FU_OVERHEAD : 1;
+    size_t max_packets = max_frame_bytes / payload + 16;
+    size_t bytes = max_frame_bytes + max_packets * (RTP_HEADER_SIZE + RTP_EXTENSIONS_SIZE + RTP_FU_OVERHEAD);
+    return growStorage(bytes) && growViews(max_packets);
+  }
+
+  void clear()
+  {
+    used_ = 0;
+    count_ = 0;
+    frame_allocations_ = 0;
+  }
+
+  // Returns writable space for one packet of the given size and records its view
+  uint8_t *allocate(size_t size)
+  {
+    if (used_ + size > storage_capacity_ && !grow(growStorage(std::max(storage_capacity_ * 2, used_ + size))))
+      return nullptr;
+    if (count_ == views_capacity_ && !grow(growViews(std::max<size_t>(views_capacity_ * 2, 64))))
+      return nullptr;
+
+    uint8_t *p = storage_ + used_;
+    views_[count_++] = {p, size};
+    used_ += size;
+    return p;
+  }
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  const RTPPacketView &operator[](size_t i) const { return views_[i]; }
+  const RTPPacketView *begin() const { return views_; }
+  const RTPPacketView *end() const { return views_ + count_; }
+
+  size_t bytesUsed() const { return used_; }
+  size_t capacity() const { return storage_capacity_; }
+  // Heap allocations made while packetizing the current frame (0 in steady state)
+  uint32_t frameAllocations() const { return frame_allocations_; }
+  uint32_t totalAllocations() const { return total_allocations_; }
+
+private:
+  AllocFn alloc_;
+  FreeFn free_;
+  uint8_t *storage_ = nullptr;
+  size_t storage_capacity_ = 0;
+  size_t used_ = 0;
+  RTPPacketView *views_ = nullptr;
+  size_t views_capacity_ = 0;
+  size_t count_ = 0;
+  uint32_t frame_allocations_ = 0;
+  uint32_t total_allocations_ = 0;
+
+  bool grow(bool ok)
+  {
+    frame_allocations_++;
+    total_allocations_++;
+    return ok;
+  }
+
+  bool growStorage(size_t bytes)
+  {
+    if (bytes <= storage_capacity_)
+      return true;
+
+    auto *p = static_cast<uint8_t *>(alloc_(bytes));
+    if (!p)
+      return false;
+
+    if (used_)
+      memcpy(p, storage_, used_);
+    // Rebase views of packets already written for this frame
+    for (size_t i = 0; i < count_; i++)
+      views_[i].data = p + (views_[i].data - storage_);
+
+    free_(storage_);
+    storage_ = p;
+    storage_capacity_ = bytes;
+    return true;
+  }
+
+  bool growViews(size_t count)
+  {
+    if (count <= views_capacity_)
+      return true;
+
+    auto *p = static_cast<RTPPacketView *>(alloc_(count * sizeof(RTPPacketView)));
+    if (!p)
+      return false;
+
+    if (count_)
+      memcpy(p, views_, count_ * sizeof(RTPPacketView));
+
+    free_(views_);
+    views_ = p;
+    views_capacity_ = count;
+    return true;
+  }
+};
+
+// RTP header length including the header extension block, 0 if malformed
+inline size_t rtpHeaderLength(const uint8_t *packet, size_t size)
+{
+  size_t header = RTP_HEADER_SIZE + (packet[0] & 0x0F) * 4;
+  if ((packet[0] & 0x10) && size >= header + 4)
+    header += 4 + ((packet[header + 2] << 8) | packet[header + 3]) * 4;
+  return header <= size ? header : 0;
+}
+
+// Fills the send-time extension fields RTPPacketizer reserved in the header.
+// Returns false if the packet carries no extension block.
+inline bool stampHeaderExtensions(uint8_t *packet, uint64_t send_time_us, uint16_t transport_seq)
+{
+  if (!(packet[0] & 0x10))
+    return false;
+
+  uint32_t abs_send_time = static_cast<uint32_t>(((send_time_us << 18) / 1000000ULL) & 0xFFFFFF);
+  uint8_t *ext = packet + RTP_HEADER_SIZE + 4;
+  ext[1] = static_cast<uint8_t>(abs_send_time >> 16);
+  ext[2] = static_cast<uint8_t>(abs_send_time >> 8);
+  ext[3] = static_cast<uint8_t>(abs_send_time);
+  ext[5] = static_cast<uint8_t>(transport_seq >> 8);
+  ext[6] = static_cast<uint8_t>(transport_seq);
+  return true;
+}
+
+// Scatter/gather form of one RTP packet: the RTP header, header extensions and
+// payload header (FU indicator/header, RTP/JPEG header) are stored inline, the
+// payload points into the caller's bitstream buffer, which must stay valid
+// until the packet has been sent.
+struct RTPPacketDescriptor
+{
+  static constexpr size_t MAX_HEADER_SIZE = RTP_HEADER_SIZE + RTP_EXTENSIONS_SIZE + RTP_PAYLOAD_HEADER_MAX_SIZE;
+
+  uint8_t header[MAX_HEADER_SIZE];
+  uint8_t header_size;
+  const uint8_t *payload;
+  size_t payload_size;
+
+  size_t size() const { return header_size + payload_size; }
+  uint16_t sequenceNumber() const { return static_cast<uint16_t>((header[2] << 8) | header[3]); }
+
+  // Type of the NAL unit carried: the fragmented unit's type for FU-A,
+  // H264_NAL_STAP_A for an aggregation packet, 0 for other payload types
+  uint8_t nalType() const
+  {
+    if ((header[1] & 0x7F) != RTP_PAYLOAD_H264)
+      return 0;
+    size_t rtp_header = RTP_HEADER_SIZE + ((header[0] & 0x10) ? RTP_EXTENSIONS_SIZE : 0);
+    if (header_size > rtp_header)
+      return header[rtp_header + 1] & 0x1F;
+    return payload_size ? payload[0] & 0x1F : 0;
+  }
+};
+
+// Reusable descriptor storage for one frame, counted like RTPPacketArena
+class RTPDescriptorList
+{
+public:
+  using AllocFn = RTPPacketArena::AllocFn;
+  using FreeFn = RTPPacketArena::FreeFn;
+
+  RTPDescriptorList(size_t max_frame_bytes = 0, uint16_t mtu = RTP_DEFAULT_MTU,
+                    AllocFn alloc = std::malloc, FreeFn release = std::free)
+      : alloc_(alloc), free_(release)
+  {
+    reserve(max_frame_bytes, mtu);
+  }
+
+  ~RTPDescriptorList()
+  {
+    free_(items_);
+    free_(storage_);
+  }
+
+  RTPDescriptorList(const RTPDescriptorList &) = delete;
+  RTPDescriptorList &operator=(const RTPDescriptorList &) = delete;
+
+  bool reserve(size_t max_frame_bytes, uint16_t mtu = RTP_DEFAULT_MTU)
+  {
+    size_t payload = mtu > RTP_HEADER_SIZE + RTP_FU_OVERHEAD ? mtu - RTP_HEADER_SIZE - RTP_FU_OVERHEAD : 1;
+    return growItems(max_frame_bytes / payload + 16) && growStorage(4 * mtu);
+  }
+
+  void clear()
+  {
+    count_ = 0;
+    used_ = 0;
+    frame_allocations_ = 0;
+  }
+
+  // Copies a payload that does not live in the source bitstream (e.g. an
+  // aggregation packet) into list-owned storage valid until clear(). Call it
+  // before allocate() for the descriptor that will point at the copy: growing
+  // the storage only rebases descriptors that are already filled in.
+  const uint8_t *store(const uint8_t *data, size_t size)
+  {
+    if (used_ + size > storage_capacity_)
+    {
+      frame_allocations_++;
+      total_allocations_++;
+      if (!growStorage(std::max(storage_capacity_ * 2, used_ + size)))
+        return nullptr;
+    }
+
+    uint8_t *p = storage_ + used_;
+    memcpy(p, data, size);
+    used_ += size;
+    return p;
+  }
+
+  RTPPacketDescriptor *allocate()
+  {
+    if (count_ == capacity_)
+    {
+      frame_allocations_++;
+      total_allocations_++;
+      if (!growItems(std::max<size_t>(capacity_ * 2, 64)))
+        return nullptr;
+    }
+    return &items_[count_++];
+  }
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  size_t capacity() const { return capacity_; }
+  const RTPPacketDescriptor &operator[](size_t i) const { return items_[i]; }
+  const RTPPacketDescriptor *begin() const { return items_; }
+  const RTPPacketDescriptor *end() const { return items_ + count_; }
+
+  uint32_t frameAllocations() const { return frame_allocations_; }
+  uint32_t totalAllocations() const { return total_allocations_; }
+
+private:
+  AllocFn alloc_;
+  FreeFn free_;
+  RTPPacketDescriptor *items_ = nullptr;
+  size_t capacity_ = 0;
+  size_t count_ = 0;
+  uint8_t *storage_ = nullptr;
+  size_t storage_capacity_ = 0;
+  size_t used_ = 0;
+  uint32_t frame_allocations_ = 0;
+  uint32_t total_allocations_ = 0;
+
+  bool growItems(size_t count)
+  {
+    if (count <= capacity_)
+      return true;
+
+    auto *p = static_cast<RTPPacketDescriptor *>(alloc_(count * sizeof(RTPPacketDescriptor)));
+    if (!p)
+      return false;
+
+    if (count_)
+      memcpy(p, items_, count_ * sizeof(RTPPacketDescriptor));
+
+    free_(items_);
+    items_ = p;
+    capacity_ = count;
+    return true;
+  }
+
+  bool growStorage(size_t bytes)
+  {
+    if (bytes <= storage_capacity_)
+      return true;
+
+    auto *p = static_cast<uint8_t *>(alloc_(bytes));
+    if (!p)
+      return false;
+
+    if (used_)
+      memcpy(p, storage_, used_);
+    // Rebase completed descriptors whose payload was stored here
+    for (size_t i = 0; i < count_; i++)
+    {
+      if (items_[i].payload >= storage_ && items_[i].payload < storage_ + used_)
+        items_[i].payload = p + (items_[i].payload - storage_);
+    }
+
+    free_(storage_);
+    storage_ = p;
+    storage_capacity_ = bytes;
+    return true;
+  }
+};
+
+// Packet geometry of one frame. RTPPacketizer latches a runtime copy when a
+// frame starts; RTPFixedLayout provides the same members as compile-time
+// constants so the packetizing loop folds them into its instructions.
+struct RTPFrameLayout
+{
+  size_t header_size; // RTP header + extension block
+  size_t max_payload; // largest single NAL unit or STAP-A payload
+  size_t fu_payload;  // NAL bytes carried per FU-A fragment
+  bool aggregation;
+  uint8_t payload_type;
+};
+
+template <uint16_t MTU, uint8_t PayloadType, bool Aggregation, bool Extensions>
+struct RTPFixedLayout
+{
+  static constexpr size_t header_size = RTP_HEADER_SIZE + (Extensions ? RTP_EXTENSIONS_SIZE : 0);
+  static_assert(MTU > header_size + RTP_FU_OVERHEAD, "MTU leaves no room for FU-A payload");
+  static constexpr size_t max_payload = MTU - header_size;
+  static constexpr size_t fu_payload = max_payload - RTP_FU_OVERHEAD;
+  static constexpr bool aggregation = Aggregation;
+  static constexpr uint8_t payload_type = PayloadType;
+};
+
+// MTU below the default that still gets a specialized packetizer; 1200 bytes
+// is the usual choice when the path has tunnel or VPN overhead
+static constexpr uint16_t RTP_SAFE_MTU = 1200;
+
 class RTPPacketizer
 {
 public:
   RTPPacketizer(uint32_t ssrc = 0x12345678, uint16_t mtu = RTP_DEFAULT_MTU)
-      : ssrc_(ssrc), sequence_number_(0), timestamp_(0),
-        max_payload_size_(mtu > RTP_HEADER_SIZE ? mtu - RTP_HEADER_SIZE : 100)
+      : ssrc_(ssrc), sequence_number_(0), timestamp_(0), mtu_(mtu),
+        stap_buffer_(mtu > RTP_HEADER_SIZE ? mtu - RTP_HEADER_SIZE : 100)
   {
   }
 
@@ -34,24 +407,136 @@ public:
   std::vector<std::vector<uint8_t>> packetize(const uint8_t *data, size_t size, uint64_t timestamp_us)
   {
     std::vector<std::vector<uint8_t>> packets;
-    if (!data || size == 0 || max_payload_size_ < 2)
+    if (!data || size == 0)
       return packets;
 
-    uint32_t new_ts = static_cast<uint32_t>((timestamp_us * RTP_CLOCK_RATE) / 1000000ULL);
-    timestamp_ = (new_ts != timestamp_) ? new_ts : timestamp_ + 1;
+    beginFrame(timestamp_us);
+    if (layout_.fu_payload == 0)
+      return packets;
 
-    packets.reserve(size / max_payload_size_ + 2);
-    processNALUnits(data, size, packets);
+    packets.reserve(size / layout_.max_payload + 2);
+    processNALUnits(layout_, data, size, [this, &packets](const uint8_t *prefix, size_t prefix_size, const uint8_t *payload, size_t payload_size, bool marker)
+                    { writePacket(packets.emplace_back(headerSize() + prefix_size + payload_size).data(),
+                                  prefix, prefix_size, payload, payload_size, marker); });
     return packets;
   }
 
+  // Allocation-free variant: packets are written into the arena, which is
+  // cleared first. Returns the number of packets produced.
+  size_t packetize(const uint8_t *data, size_t size, uint64_t timestamp_us, RTPPacketArena &arena)
+  {
+    arena.clear();
+    if (!data || size == 0)
+      return 0;
+
+    beginFrame(timestamp_us);
+    if (layout_.fu_payload == 0)
+      return 0;
+
+    processNALUnits(layout_, data, size, [this, &arena](const uint8_t *prefix, size_t prefix_size, const uint8_t *payload, size_t payload_size, bool marker)
+                    {
+                      if (uint8_t *packet = arena.allocate(headerSize() + prefix_size + payload_size))
+                        writePacket(packet, prefix, prefix_size, payload, payload_size, marker); });
+    return arena.size();
+  }
+
+  // Zero-copy variant: each descriptor holds the RTP header (and FU bytes)
+  // and a payload span into data, so data must outlive the send. Annex B
+  // parameter_sets, if given, are sent in front of the frame as part of the
+  // same access unit and must outlive the send as well.
+  //
+  // Frames whose MTU, aggregation and extension settings match a compiled-in
+  // RTPFixedLayout run through that instantiation, everything else through
+  // the runtime layout. Both produce identical packets.
+  size_t packetize(const uint8_t *data, size_t size, uint64_t timestamp_us, RTPDescriptorList &descriptors,
+                   const uint8_t *parameter_sets = nullptr, size_t parameter_sets_size = 0)
+  {
+    descriptors.clear();
+    if (!data || size == 0)
+      return 0;
+
+    beginFrame(timestamp_us);
+    if (layout_.fu_payload == 0)
+      return 0;
+
+    if (fixed_)
+      return (this->*fixed_)(data, size, descriptors, parameter_sets, parameter_sets_size);
+    return packetizeDescriptors(layout_, data, size, descriptors, parameter_sets, parameter_sets_size);
+  }
+
+  uint16_t mtu() const { return mtu_; }
+  uint32_t ssrc() const { return ssrc_; }
+
+  // Next sequence number, lets another packetizer continue the same stream
+  uint16_t sequenceNumber() const { return sequence_number_; }
+  void setSequenceNumber(uint16_t sequence_number) { sequence_number_ = sequence_number; }
+
+  // RTP timestamp for a monotonic time in microseconds, the same mapping
+  // packetize() applies to frame timestamps (used by RTCP sender reports)
+  static uint32_t rtpTimestamp(uint64_t timestamp_us)
+  {
+    return static_cast<uint32_t>((timestamp_us * RTP_CLOCK_RATE) / 1000000ULL);
+  }
+
+  // RFC 6184 STAP-A: consecutive NALs that fit together in one payload are
+  // sent as a single aggregation packet. Off by default, receivers opt in.
+  void setAggregation(bool enabled) { aggregation_ = enabled; }
+  bool aggregation() const { return aggregation_; }
+
+  // Reserves the RFC 8285 abs-send-time and transport-wide sequence
+  // extensions in every header (payloads shrink by RTP_EXTENSIONS_SIZE); the
+  // sender fills them with stampHeaderExtensions(). Applies from the next frame.
+  void setHeaderExtensions(bool enabled) { extensions_ = enabled; }
+  bool headerExtensions() const { return extensions_; }
+
+  // Use the compile-time specialized descriptor path when one matches (on by
+  // default). Applies from the next frame.
+  void setSpecialization(bool enabled) { specialization_ = enabled; }
+  // True if the current frame runs through a specialized instantiation
+  bool specialized() const { return fixed_ != nullptr; }
+
   void resetSequence()
   {
     sequence_number_ = 0;
     timestamp_ = 0;
   }
 
-private:
+  // Incremental interface for encoders that hand out an access unit in pieces
+  // (per slice or per output buffer). feed() emits packets through
+  // on_packet(const uint8_t *packet, size_t size) as soon as their bytes are
+  // known, so the first packet does not wait for the whole frame. Only the
+  // newest packet is held back until it is known whether it ends the access
+  // unit (marker bit). Produces the same packets as packetize() without
+  // aggregation; STAP-A is not used here.
+  void beginAccessUnit(uint64_t timestamp_us)
+  {
+    beginFrame(timestamp_us);
+    stream_pending_.clear();
+    stream_pending_.reserve(2 * mtu_ + STREAM_LOOKAHEAD);
+    stream_held_.resize(mtu_);
+    stream_held_size_ = 0;
+    stream_in_nal_ = false;
+    stream_fragmenting_ = false;
+    stream_packets_ = 0;
+  }
+
+  template <typename OnPacket>
+  void feed(const uint8_t *data, size_t size, OnPacket &&on_packet)
+  {
+    stream_pending_.insert(stream_pending_.end(), data, data + size);
+    drainStream(false, on_packet);
+  }
+
+  // Flushes the last NAL, sends the held packet with the marker bit and
+  // returns the number of packets of the access unit
+  template <typename OnPacket>
+  size_t endAccessUnit(OnPacket &&on_packet)
+  {
+    drainStream(true, on_packet);
+    releaseHeld(true, on_packet);
+    return stream_packets_;
+  }
+
   // Returns pointer to the first byte of the next start code and sets sc_len,
   // or nullptr if none found in [p, end).
   static const uint8_t *findStartCode(const uint8_t *p, const uint8_t *end, uint8_t &sc_len)
@@ -77,7 +562,101 @@ private:
     return nullptr;
   }
 
-  void processNALUnits(const uint8_t *data, size_t size, std::vector<std::vector<uint8_t>> &packets)
+private:
+  using FixedPacketizeFn = size_t (RTPPacketizer::*)(const uint8_t *, size_t, RTPDescriptorList &,
+                                                     const uint8_t *, size_t);
+
+  // Per-frame settings are latched here so a change from another task never
+  // lands in the middle of a frame
+  void beginFrame(uint64_t timestamp_us)
+  {
+    bool extensions = extensions_;
+    bool aggregation = aggregation_;
+    layout_.header_size = RTP_HEADER_SIZE + (extensions ? RTP_EXTENSIONS_SIZE : 0);
+    layout_.max_payload = mtu_ > layout_.header_size ? mtu_ - layout_.header_size : 100;
+    layout_.fu_payload = layout_.max_payload > RTP_FU_OVERHEAD ? layout_.max_payload - RTP_FU_OVERHEAD : 0;
+    layout_.aggregation = aggregation;
+    layout_.payload_type = RTP_PAYLOAD_H264;
+    fixed_ = specialization_ ? fixedVariant(mtu_, aggregation, extensions) : nullptr;
+
+    updateTimestamp(timestamp_us);
+    buildHeaderTemplate(extensions);
+  }
+
+  // Instantiated for the MTUs the streamer is configured with, other MTUs
+  // use the runtime layout
+  static FixedPacketizeFn fixedVariant(uint16_t mtu, bool aggregation, bool extensions)
+  {
+    switch (mtu)
+    {
+    case RTP_DEFAULT_MTU:
+      return fixedVariantFor<RTP_DEFAULT_MTU>(aggregation, extensions);
+    case RTP_SAFE_MTU:
+      return fixedVariantFor<RTP_SAFE_MTU>(aggregation, extensions);
+    default:
+      return nullptr;
+    }
+  }
+
+  template <uint16_t MTU>
+  static FixedPacketizeFn fixedVariantFor(bool aggregation, bool extensions)
+  {
+    static constexpr FixedPacketizeFn VARIANTS[4] = {
+        &RTPPacketizer::packetizeFixed<MTU, false, false>,
+        &RTPPacketizer::packetizeFixed<MTU, false, true>,
+        &RTPPacketizer::packetizeFixed<MTU, true, false>,
+        &RTPPacketizer::packetizeFixed<MTU, true, true>,
+    };
+    return VARIANTS[(aggregation ? 2 : 0) | (extensions ? 1 : 0)];
+  }
+
+  template <uint16_t MTU, bool Aggregation, bool Extensions>
+  size_t packetizeFixed(const uint8_t *data, size_t size, RTPDescriptorList &descriptors,
+                        const uint8_t *parameter_sets, size_t parameter_sets_size)
+  {
+    return packetizeDescriptors(RTPFixedLayout<MTU, RTP_PAYLOAD_H264, Aggregation, Extensions>{},
+                                data, size, descriptors, parameter_sets, parameter_sets_size);
+  }
+
+  template <typename Layout>
+  size_t packetizeDescriptors(const Layout &layout, const uint8_t *data, size_t size, RTPDescriptorList &descriptors,
+                              const uint8_t *parameter_sets, size_t parameter_sets_size)
+  {
+    auto emit = [this, &layout, &descriptors](const uint8_t *prefix, size_t prefix_size, const uint8_t *payload, size_t payload_size, bool marker)
+    {
+      if (isStapBuffer(payload) && !(payload = descriptors.store(payload, payload_size)))
+        return;
+      RTPPacketDescriptor *d = descriptors.allocate();
+      if (!d)
+        return;
+      writeRTPHeader(layout, d->header, marker);
+      if (prefix_size)
+        memcpy(d->header + layout.header_size, prefix, RTP_FU_OVERHEAD);
+      d->header_size = static_cast<uint8_t>(layout.header_size + prefix_size);
+      d->payload = payload;
+      d->payload_size = payload_size;
+    };
+
+    if (parameter_sets && parameter_sets_size)
+      processNALUnits(layout, parameter_sets, parameter_sets_size, emit, false);
+    processNALUnits(layout, data, size, emit);
+    return descriptors.size();
+  }
+
+  size_t headerSize() const { return layout_.header_size; }
+
+  void updateTimestamp(uint64_t timestamp_us)
+  {
+    uint32_t new_ts = rtpTimestamp(timestamp_us);
+    timestamp_ = (new_ts != timestamp_) ? new_ts : timestamp_ + 1;
+  }
+
+  // emit(prefix, prefix_size, payload, payload_size, marker) is called once per
+  // packet; prefix holds the FU indicator/header for fragments. With
+  // ends_frame false the buffer is only the head of an access unit: no marker
+  // is set and a pending aggregate is carried over into the next buffer.
+  template <typename Layout, typename Emit>
+  void processNALUnits(const Layout &layout, const uint8_t *data, size_t size, Emit &&emit, bool ends_frame = true)
   {
     const uint8_t *end = data + size;
     uint8_t sc_len = 0;
@@ -96,37 +675,81 @@ private:
       size_t nal_size = nal_end - nal;
       uint8_t nal_header = *nal;
       uint8_t nal_type = nal_header & 0x1F;
-      bool is_last = (next_sc == nullptr);
+      bool is_last = ends_frame && next_sc == nullptr;
 
       if (nal_type >= 1 && nal_type <= 23 && nal_size > 0)
       {
-        if (nal_size <= max_payload_size_)
-          packetizeSingle(nal, nal_size, is_last, packets);
+        if (layout.aggregation && RTP_STAP_HEADER_SIZE + RTP_STAP_LENGTH_SIZE + nal_size <= layout.max_payload)
+        {
+          if (stap_count_ && stap_size_ + RTP_STAP_LENGTH_SIZE + nal_size > layout.max_payload)
+            flushAggregate(false, emit);
+          appendAggregate(nal, nal_size);
+          if (is_last)
+            flushAggregate(true, emit);
+        }
         else
-          packetizeFragmented(nal, nal_size, nal_header, is_last, packets);
+        {
+          flushAggregate(false, emit);
+          if (nal_size <= layout.max_payload)
+            emit(nullptr, 0, nal, nal_size, is_last);
+          else
+            packetizeFragmented(layout, nal, nal_size, nal_header, is_last, emit);
+        }
       }
 
       if (!next_sc)
         break;
       nal = next_sc + sc_len;
     }
+
+    // Trailing NALs with unsupported types still close the frame
+    if (ends_frame)
+      flushAggregate(true, emit);
   }
 
-  void packetizeSingle(const uint8_t *data, size_t size, bool marker,
-                       std::vector<std::vector<uint8_t>> &packets)
+  void appendAggregate(const uint8_t *nal, size_t size)
   {
-    std::vector<uint8_t> packet(RTP_HEADER_SIZE + size);
-    writeRTPHeader(packet.data(), marker);
-    memcpy(packet.data() + RTP_HEADER_SIZE, data, size);
-    packets.push_back(std::move(packet));
+    if (stap_count_ == 0)
+    {
+      stap_first_ = nal;
+      stap_first_size_ = size;
+      stap_buffer_[0] = H264_NAL_STAP_A;
+      stap_size_ = RTP_STAP_HEADER_SIZE;
+    }
+
+    // F is the OR of the aggregated F bits, NRI the maximum NRI
+    uint8_t f = (stap_buffer_[0] | nal[0]) & 0x80;
+    uint8_t nri = std::max(stap_buffer_[0] & 0x60, nal[0] & 0x60);
+    stap_buffer_[0] = f | nri | H264_NAL_STAP_A;
+
+    stap_buffer_[stap_size_] = static_cast<uint8_t>(size >> 8);
+    stap_buffer_[stap_size_ + 1] = static_cast<uint8_t>(size & 0xFF);
+    memcpy(&stap_buffer_[stap_size_ + RTP_STAP_LENGTH_SIZE], nal, size);
+    stap_size_ += RTP_STAP_LENGTH_SIZE + size;
+    stap_count_++;
+  }
+
+  // A lone pending NAL goes out as a plain single NAL packet
+  template <typename Emit>
+  void flushAggregate(bool marker, Emit &emit)
+  {
+    if (stap_count_ == 1)
+      emit(nullptr, 0, stap_first_, stap_first_size_, marker);
+    else if (stap_count_ > 1)
+      emit(nullptr, 0, stap_buffer_.data(), stap_size_, marker);
+    stap_count_ = 0;
   }
 
-  void packetizeFragmented(const uint8_t *data, size_t size, uint8_t nal_header,
-                           bool is_last_nal, std::vector<std::vector<uint8_t>> &packets)
+  bool isStapBuffer(const uint8_t *p) const
   {
-    static constexpr size_t FU_OVERHEAD = 2; // FU indicator + FU header
+    return p >= stap_buffer_.data() && p < stap_buffer_.data() + stap_buffer_.size();
+  }
 
-    const size_t fu_payload = max_payload_size_ - FU_OVERHEAD;
+  template <typename Layout, typename Emit>
+  void packetizeFragmented(const Layout &layout, const uint8_t *data, size_t size, uint8_t nal_header,
+                           bool is_last_nal, Emit &emit)
+  {
+    const size_t fu_payload = layout.fu_payload;
     const uint8_t *payload = data + 1; // skip NAL header byte
     size_t remaining = size - 1;
     bool first = true;
@@ -136,14 +759,11 @@ private:
       size_t chunk = std::min(fu_payload, remaining);
       bool last_frag = (chunk >= remaining);
 
-      std::vector<uint8_t> packet(RTP_HEADER_SIZE + FU_OVERHEAD + chunk);
-      writeRTPHeader(packet.data(), last_frag && is_last_nal);
-
-      packet[RTP_HEADER_SIZE] = (nal_header & 0xE0) | 28;
-      packet[RTP_HEADER_SIZE + 1] = (first ? 0x80 : 0x00) | (last_frag ? 0x40 : 0x00) | (nal_header & 0x1F);
+      uint8_t fu[RTP_FU_OVERHEAD];
+      fu[0] = (nal_header & 0xE0) | H264_NAL_FU_A;
+      fu[1] = (first ? 0x80 : 0x00) | (last_frag ? 0x40 : 0x00) | (nal_header & 0x1F);
 
-      memcpy(packet.data() + RTP_HEADER_SIZE + FU_OVERHEAD, payload, chunk);
-      packets.push_back(std::move(packet));
+      emit(fu, RTP_FU_OVERHEAD, payload, chunk, last_frag && is_last_nal);
 
       payload += chunk;
       remaining -= chunk;
@@ -151,18 +771,188 @@ private:
     }
   }
 
-  void writeRTPHeader(uint8_t *buf, bool marker)
+  void writePacket(uint8_t *packet, const uint8_t *prefix, size_t prefix_size,
+                   const uint8_t *payload, size_t payload_size, bool marker)
   {
-    auto *h = reinterpret_cast<RTPHeader *>(buf);
+    writeRTPHeader(layout_, packet, marker);
+    if (prefix_size)
+      memcpy(packet + headerSize(), prefix, prefix_size);
+    memcpy(packet + headerSize() + prefix_size, payload, payload_size);
+  }
+
+  // Everything but marker and sequence number is fixed for the frame
+  void buildHeaderTemplate(bool extensions)
+  {
+    auto *h = reinterpret_cast<RTPHeader *>(header_template_);
     h->version_padding_cc = RTP_VERSION << 6;
-    h->marker_payload_type = (marker ? 0x80 : 0x00) | RTP_PAYLOAD_H264;
-    h->sequence_number = htons(sequence_number_++);
+    h->marker_payload_type = layout_.payload_type;
+    h->sequence_number = 0;
     h->timestamp = htonl(timestamp_);
     h->ssrc = htonl(ssrc_);
+
+    if (extensions)
+    {
+      h->version_padding_cc |= 0x10;
+      memcpy(header_template_ + RTP_HEADER_SIZE, RTP_EXTENSIONS_TEMPLATE, sizeof(RTP_EXTENSIONS_TEMPLATE));
+    }
+  }
+
+  template <typename Layout>
+  void writeRTPHeader(const Layout &layout, uint8_t *buf, bool marker)
+  {
+    memcpy(buf, header_template_, layout.header_size);
+    buf[1] = (marker ? 0x80 : 0x00) | layout.payload_type;
+    buf[2] = static_cast<uint8_t>(sequence_number_ >> 8);
+    buf[3] = static_cast<uint8_t>(sequence_number_ & 0xFF);
+    sequence_number_++;
   }
 
   uint32_t ssrc_;
   uint16_t sequence_number_;
   uint32_t timestamp_;
-  size_t max_payload_size_;
+  uint16_t mtu_;
+  bool extensions_ = false;
+  bool specialization_ = true;
+  RTPFrameLayout layout_ = {};
+  FixedPacketizeFn fixed_ = nullptr;
+  uint8_t header_template_[RTP_HEADER_SIZE + RTP_EXTENSIONS_SIZE] = {};
+
+  bool aggregation_ = false;
+  std::vector<uint8_t> stap_buffer_;
+  size_t stap_size_ = 0;
+  size_t stap_count_ = 0;
+  const uint8_t *stap_first_ = nullptr;
+  size_t stap_first_size_ = 0;
+
+  // Incremental packetization state. A 4-byte start code split across two
+  // feed() calls must still be found, so that many bytes are never sent
+  // before the next chunk arrives.
+  static constexpr size_t STREAM_LOOKAHEAD = 4;
+  std::vector<uint8_t> stream_pending_;
+  std::vector<uint8_t> stream_held_;
+  size_t stream_held_size_ = 0;
+  bool stream_in_nal_ = false;
+  bool stream_fragmenting_ = false;
+  uint8_t stream_nal_header_ = 0;
+  size_t stream_packets_ = 0;
+
+  template <typename OnPacket>
+  void drainStream(bool end_of_unit, OnPacket &on_packet)
+  {
+    const size_t fu_payload = layout_.fu_payload;
+    const uint8_t *base = stream_pending_.data();
+    const uint8_t *stop = base + stream_pending_.size();
+    const uint8_t *pos = base;
+
+    while (pos < stop)
+    {
+      uint8_t sc_len = 0;
+      if (!stream_in_nal_)
+      {
+        const uint8_t *sc = findStartCode(pos, stop, sc_len);
+        if (!sc || sc + sc_len >= stop)
+        {
+          // Keep what may be the beginning of a split start code
+          if (!sc)
+            pos = stop - std::min<size_t>(stop - pos, STREAM_LOOKAHEAD - 1);
+          else
+            pos = sc;
+          break;
+        }
+        pos = sc + sc_len;
+        stream_in_nal_ = true;
+        stream_fragmenting_ = false;
+        stream_nal_header_ = *pos;
+        continue;
+      }
+
+      bool supported = (stream_nal_header_ & 0x1F) >= 1 && (stream_nal_header_ & 0x1F) <= 23;
+      const uint8_t *next = findStartCode(stream_fragmenting_ ? pos : pos + 1, stop, sc_len);
+      if (next || end_of_unit)
+      {
+        const uint8_t *nal_end = next ? next : stop;
+        if (supported)
+          finishStreamNal(pos, nal_end - pos, fu_payload, on_packet);
+        stream_in_nal_ = false;
+        pos = nal_end;
+        if (!next)
+          break;
+        continue;
+      }
+
+      // NAL still open: send every full fragment that cannot be the last one
+      size_t skip = stream_fragmenting_ ? 0 : 1;
+      while (static_cast<size_t>(stop - pos) >= skip + fu_payload + STREAM_LOOKAHEAD)
+      {
+        if (supported)
+          writeStreamFragment(pos + skip, fu_payload, false, on_packet);
+        pos += skip + fu_payload;
+        skip = 0;
+        stream_fragmenting_ = true;
+      }
+      break;
+    }
+
+    stream_pending_.erase(stream_pending_.begin(), stream_pending_.begin() + (pos - base));
+  }
+
+  template <typename OnPacket>
+  void finishStreamNal(const uint8_t *p, size_t size, size_t fu_payload, OnPacket &on_packet)
+  {
+    if (!stream_fragmenting_)
+    {
+      if (size <= layout_.max_payload)
+      {
+        writeStreamPacket(nullptr, 0, p, size, on_packet);
+        return;
+      }
+      p++; // NAL header travels in the FU bytes
+      size--;
+    }
+    else if (size == 0)
+    {
+      // The previous fragment turned out to be the last one
+      stream_held_[headerSize() + 1] |= 0x40;
+      return;
+    }
+
+    while (size > 0)
+    {
+      size_t chunk = std::min(fu_payload, size);
+      writeStreamFragment(p, chunk, chunk == size, on_packet);
+      stream_fragmenting_ = true;
+      p += chunk;
+      size -= chunk;
+    }
+  }
+
+  template <typename OnPacket>
+  void writeStreamFragment(const uint8_t *payload, size_t size, bool last, OnPacket &on_packet)
+  {
+    uint8_t fu[RTP_FU_OVERHEAD];
+    fu[0] = (stream_nal_header_ & 0xE0) | H264_NAL_FU_A;
+    fu[1] = (stream_fragmenting_ ? 0x00 : 0x80) | (last ? 0x40 : 0x00) | (stream_nal_header_ & 0x1F);
+    writeStreamPacket(fu, RTP_FU_OVERHEAD, payload, size, on_packet);
+  }
+
+  template <typename OnPacket>
+  void writeStreamPacket(const uint8_t *prefix, size_t prefix_size, const uint8_t *payload, size_t size,
+                         OnPacket &on_packet)
+  {
+    releaseHeld(false, on_packet);
+    writePacket(stream_held_.data(), prefix, prefix_size, payload, size, false);
+    stream_held_size_ = headerSize() + prefix_size + size;
+    stream_packets_++;
+  }
+
+  template <typename OnPacket>
+  void releaseHeld(bool marker, OnPacket &on_packet)
+  {
+    if (!stream_held_size_)
+      return;
+    if (marker)
+      stream_held_[1] |= 0x80;
+    on_packet(static_cast<const uint8_t *>(stream_held_.data()), stream_held_size_);
+    stream_held_size_ = 0;
+  }
 };
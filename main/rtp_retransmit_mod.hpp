@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#include "rtp_packetizer_mod.hpp"
+
+// Selective retransmission: a ring of recently sent packets indexed by
+// sequence number, RFC 4585 generic NACK parsing and RFC 4588 RTX packets.
+// Standard library only, so the receive side can be exercised on a host.
+
+static constexpr uint8_t RTP_PAYLOAD_RTX = 97;
+static constexpr uint8_t RTCP_PT_RTPFB = 205;
+static constexpr uint8_t RTCP_FMT_GENERIC_NACK = 1;
+static constexpr size_t RTP_RTX_OSN_SIZE = 2;
+
+// Fixed slots of one MTU each, slot = sequence % slots. The encoder buffer the
+// descriptors point into is handed back to the driver after every frame, so
+// packets are copied in as they are sent.
+class RTPPacketHistory
+{
+public:
+  using AllocFn = RTPPacketArena::AllocFn;
+  using FreeFn = RTPPacketArena::FreeFn;
+
+  RTPPacketHistory(size_t slots, uint16_t mtu = RTP_DEFAULT_MTU,
+                   AllocFn alloc = std::malloc, FreeFn release = std::free)
+      : free_(release), slot_size_(mtu)
+  {
+    if (slots == 0)
+      return;
+    storage_ = static_cast<uint8_t *>(alloc(slots * slot_size_));
+    entries_ = static_cast<Entry *>(alloc(slots * sizeof(Entry)));
+    if (!storage_ || !entries_)
+    {
+      free_(storage_);
+      free_(entries_);
+      storage_ = nullptr;
+      entries_ = nullptr;
+      return;
+    }
+    slots_ = slots;
+    memset(entries_, 0, slots * sizeof(Entry));
+  }
+
+  ~RTPPacketHistory()
+  {
+    free_(storage_);
+    free_(entries_);
+  }
+
+  RTPPacketHistory(const RTPPacketHistory &) = delete;
+  RTPPacketHistory &operator=(const RTPPacketHistory &) = delete;
+
+  size_t slots() const { return slots_; }
+
+  void store(const RTPPacketDescriptor &packet)
+  {
+    if (!slots_ || packet.size() > slot_size_)
+      return;
+
+    uint16_t seq = static_cast<uint16_t>((packet.header[2] << 8) | packet.header[3]);
+    size_t index = seq % slots_;
+    uint8_t *slot = storage_ + index * slot_size_;
+    memcpy(slot, packet.header, packet.header_size);
+    memcpy(slot + packet.header_size, packet.payload, packet.payload_size);
+    entries_[index] = {seq, static_cast<uint16_t>(packet.size())};
+  }
+
+  // Returns {nullptr, 0} if the packet was never stored or already overwritten
+  RTPPacketView find(uint16_t seq) const
+  {
+    if (!slots_)
+      return {nullptr, 0};
+    const Entry &e = entries_[seq % slots_];
+    if (e.size == 0 || e.sequence != seq)
+      return {nullptr, 0};
+    return {storage_ + (seq % slots_) * slot_size_, e.size};
+  }
+
+private:
+  struct Entry
+  {
+    uint16_t sequence;
+    uint16_t size; // 0 = empty
+  };
+
+  FreeFn free_;
+  uint8_t *storage_ = nullptr;
+  Entry *entries_ = nullptr;
+  size_t slots_ = 0;
+  size_t slot_size_;
+};
+
+// Builds RFC 4588 RTX packets: own SSRC and sequence space, original
+// sequence number (OSN) in front of the original payload.
+class RTPRtxWriter
+{
+public:
+  explicit RTPRtxWriter(uint32_t ssrc, uint8_t payload_type = RTP_PAYLOAD_RTX)
+      : ssrc_(ssrc), payload_type_(payload_type)
+  {
+  }
+
+  // out must hold original.size + RTP_RTX_OSN_SIZE bytes, returns the size
+  // written or 0 for a malformed original
+  size_t write(const RTPPacketView &original, uint8_t *out)
+  {
+    if (original.size < RTP_HEADER_SIZE || (original.data[0] & 0x0F) != 0)
+      return 0; // packetizer output never carries CSRCs
+
+    // Header extensions stay with the header, OSN goes in front of the payload
+    size_t header = rtpHeaderLength(original.data, original.size);
+    if (header == 0)
+      return 0;
+
+    memcpy(out, original.data, header);
+    out[1] = (original.data[1] & 0x80) | payload_type_;
+    out[2] = static_cast<uint8_t>(sequence_number_ >> 8);
+    out[3] = static_cast<uint8_t>(sequence_number_ & 0xFF);
+    sequence_number_++;
+    out[8] = static_cast<uint8_t>(ssrc_ >> 24);
+    out[9] = static_cast<uint8_t>(ssrc_ >> 16);
+    out[10] = static_cast<uint8_t>(ssrc_ >> 8);
+    out[11] = static_cast<uint8_t>(ssrc_);
+
+    // OSN is the original sequence number, already big endian
+    out[header] = original.data[2];
+    out[header + 1] = original.data[3];
+    memcpy(out + header + RTP_RTX_OSN_SIZE, original.data + header, original.size - header);
+    return original.size + RTP_RTX_OSN_SIZE;
+  }
+
+private:
+  uint32_t ssrc_;
+  uint8_t payload_type_;
+  uint16_t sequence_number_ = 0;
+};
+
+// True if the datagram starts like an RTCP packet (version 2, PT 192..223),
+// which never collides with a text command
+inline bool isRTCPPacket(const uint8_t *data, size_t size)
+{
+  return size >= 8 && (data[0] >> 6) == RTP_VERSION && data[1] >= 192 && data[1] <= 223;
+}
+
+// Walks a (compound) RTCP packet and calls on_lost(seq) for every sequence
+// number requested by RFC 4585 generic NACK FCI entries (PID + bitmask of
+// the following 16). NACKs for other streams (FEC, RTX) are skipped.
+// Returns the number of sequence numbers reported.
+template <typename OnLost>
+size_t parseGenericNack(const uint8_t *data, size_t size, uint32_t media_ssrc, OnLost &&on_lost)
+{
+  size_t reported = 0;
+  size_t pos = 0;
+  while (pos + 4 <= size)
+  {
+    const uint8_t *p = data + pos;
+    size_t length = (((p[2] << 8) | p[3]) + 1) * 4;
+    if ((p[0] >> 6) != RTP_VERSION || pos + length > size)
+      break;
+
+    // header, sender SSRC, media SSRC, then 4-byte FCI entries
+    if (p[1] == RTCP_PT_RTPFB && (p[0] & 0x1F) == RTCP_FMT_GENERIC_NACK && length >= 12)
+    {
+      uint32_t media = (uint32_t(p[8]) << 24) | (uint32_t(p[9]) << 16) | (uint32_t(p[10]) << 8) | p[11];
+      for (size_t fci = 12; media == media_ssrc && fci + 4 <= length; fci += 4)
+      {
+        uint16_t pid = static_cast<uint16_t>((p[fci] << 8) | p[fci + 1]);
+        uint16_t blp = static_cast<uint16_t>((p[fci + 2] << 8) | p[fci + 3]);
+        on_lost(pid);
+        reported++;
+        for (int bit = 0; bit < 16; bit++)
+        {
+          if (blp & (1 << bit))
+          {
+            on_lost(static_cast<uint16_t>(pid + bit + 1));
+            reported++;
+          }
+        }
+      }
+    }
+    pos += length;
+  }
+  return reported;
+}
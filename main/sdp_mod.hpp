@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdarg>
+#include "lwip/sockets.h"
+
+#include "rtp_packetizer_mod.hpp"
+#include "rtp_jpeg_mod.hpp"
+#include "rtp_fec_mod.hpp"
+
+// RFC 4566 session description for the stream, so a receiver (ffplay, VLC,
+// GStreamer's sdpdemux) can be pointed at a file instead of hand-written caps
+struct SdpStreamDescription
+{
+  uint32_t session_id = 0;    // the RTP SSRC, stable for the session
+  struct in_addr origin = {}; // address of this device
+  struct in_addr destination = {};
+  uint16_t port = 0;
+  uint8_t ttl = 0; // multicast TTL, 0 for a unicast destination
+  bool jpeg = false;
+  bool header_extensions = false;
+  bool fec = false;
+};
+
+class SdpWriter
+{
+public:
+  SdpWriter(char *out, size_t capacity) : out_(out), capacity_(capacity) {}
+
+  // Returns the length written, 0 if the description did not fit
+  size_t write(const SdpStreamDescription &d)
+  {
+    char origin[16], destination[16];
+    inet_ntoa_r(d.origin, origin, sizeof(origin));
+    inet_ntoa_r(d.destination, destination, sizeof(destination));
+    uint8_t media_pt = d.jpeg ? RTP_PAYLOAD_JPEG : RTP_PAYLOAD_H264;
+
+    line("v=0");
+    line("o=- %lu 1 IN IP4 %s", d.session_id, origin);
+    line("s=cyber-eye");
+    if (d.ttl > 0)
+      line("c=IN IP4 %s/%u", destination, d.ttl);
+    else
+      line("c=IN IP4 %s", destination);
+    line("t=0 0");
+    if (d.fec)
+      line("m=video %u RTP/AVP %u %u", d.port, media_pt, RTP_PAYLOAD_FEC);
+    else
+      line("m=video %u RTP/AVP %u", d.port, media_pt);
+
+    if (d.jpeg)
+    {
+      line("a=rtpmap:%u JPEG/90000", media_pt);
+    }
+    else
+    {
+      line("a=rtpmap:%u H264/90000", media_pt);
+      line("a=fmtp:%u packetization-mode=1", media_pt);
+    }
+    if (d.fec)
+      line("a=rtpmap:%u ulpfec/90000", RTP_PAYLOAD_FEC);
+    if (d.header_extensions)
+    {
+      line("a=extmap:%u http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time", RTP_EXT_ABS_SEND_TIME_ID);
+      line("a=extmap:%u http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01", RTP_EXT_TRANSPORT_SEQ_ID);
+    }
+    line("a=recvonly");
+
+    return overflow_ ? 0 : len_;
+  }
+
+private:
+  char *out_;
+  size_t capacity_;
+  size_t len_ = 0;
+  bool overflow_ = false;
+
+  void line(const char *fmt, ...)
+  {
+    if (overflow_)
+      return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out_ + len_, capacity_ - len_, fmt, args);
+    va_end(args);
+    if (n < 0 || len_ + n + 2 >= capacity_)
+    {
+      overflow_ = true;
+      return;
+    }
+    len_ += n;
+    out_[len_++] = '\r';
+    out_[len_++] = '\n';
+    out_[len_] = '\0';
+  }
+};
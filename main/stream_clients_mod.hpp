@@ -0,0 +1,293 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#ifdef ESP_PLATFORM
+#include "lwip/sockets.h"
+#else
+#include <arpa/inet.h> // host benchmarks
+#endif
+
+static constexpr size_t STREAM_MAX_CLIENTS = 8;
+
+// IP multicast output: one copy on the air for every receiver in the group
+struct StreamMulticastSettings
+{
+  struct in_addr group = {};
+  uint16_t port = 5004;
+  uint8_t ttl = 1;
+  bool join = false; // join the group so IGMP snooping switches see a member
+};
+
+inline bool isMulticastAddress(const struct in_addr &addr)
+{
+  return (ntohl(addr.s_addr) & 0xF0000000u) == 0xE0000000u; // 224.0.0.0/4
+}
+
+// Per-viewer counters, written by the data task and read by the info command
+struct StreamClientStats
+{
+  std::atomic<uint32_t> frames{0};
+  std::atomic<uint32_t> packets{0};
+  std::atomic<uint32_t> bytes{0}; // wraps like the RTCP octet count
+  std::atomic<uint32_t> drops{0};
+  std::atomic<uint32_t> send_us{0}; // time spent in the send backend for this viewer
+  // Dependency tracking: frames skipped while waiting for an IDR, bytes sent
+  // in frames the viewer only got part of, bytes not sent because of that
+  std::atomic<uint32_t> skipped_frames{0};
+  std::atomic<uint32_t> wasted_bytes{0};
+  std::atomic<uint32_t> saved_bytes{0};
+  std::atomic<uint32_t> errors{0}; // hard send errors, each ends a frame
+  std::atomic<uint32_t> retransmits{0};
+  std::atomic<uint32_t> fec_packets{0};
+  std::atomic<uint32_t> last_keyframe_ms{0}; // esp_timer ms, 0 = none yet
+  // Over the last second, updated by the data task
+  std::atomic<uint32_t> rate_kbps{0};
+  std::atomic<uint32_t> rate_fps{0};
+
+  void reset()
+  {
+    frames = 0;
+    packets = 0;
+    bytes = 0;
+    drops = 0;
+    send_us = 0;
+    skipped_frames = 0;
+    wasted_bytes = 0;
+    saved_bytes = 0;
+    errors = 0;
+    retransmits = 0;
+    fec_packets = 0;
+    last_keyframe_ms = 0;
+    rate_kbps = 0;
+    rate_fps = 0;
+  }
+};
+
+// Stream-wide figures for the report command, updated by the data task
+struct StreamReportCounters
+{
+  std::atomic<uint32_t> frames{0}; // sent to at least one viewer
+  std::atomic<uint32_t> fps{0};    // over the last second
+  std::atomic<uint32_t> kbps{0};
+  std::atomic<uint32_t> last_keyframe_ms{0}; // esp_timer ms, 0 = none yet
+};
+
+// Viewers of the stream: unicast clients plus at most one multicast group,
+// which has its own slot after the unicast ones and does not count against
+// their capacity. The control task adds and removes entries, the data task
+// takes a snapshot per frame so a change never lands in the middle of one.
+// Indices stay stable while an entry exists.
+class StreamClientTable
+{
+public:
+  static constexpr uint8_t MULTICAST_INDEX = STREAM_MAX_CLIENTS;
+
+  struct Destination
+  {
+    uint8_t index;
+    struct sockaddr_in addr;
+  };
+
+  explicit StreamClientTable(size_t capacity = 4) : capacity_(std::min(capacity, STREAM_MAX_CLIENTS)) {}
+
+  // Adds the viewer, or keeps the existing entry of one that sent start
+  // again. Returns its index, -1 if the table is full.
+  int add(const struct sockaddr_in &addr, bool &added)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    added = false;
+    int free_slot = -1;
+    for (size_t i = 0; i < capacity_; i++)
+    {
+      if (entries_[i].active && sameEndpoint(entries_[i].addr, addr))
+        return static_cast<int>(i);
+      if (!entries_[i].active && free_slot < 0)
+        free_slot = static_cast<int>(i);
+    }
+    if (free_slot < 0)
+      return -1;
+
+    entries_[free_slot].addr = addr;
+    entries_[free_slot].active = true;
+    stats_[free_slot].reset();
+    transport_seq_[free_slot] = 0;
+    join_generation_[free_slot]++;
+    count_++;
+    added = true;
+    return free_slot;
+  }
+
+  bool remove(const struct sockaddr_in &addr)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < capacity_; i++)
+    {
+      if (entries_[i].active && sameEndpoint(entries_[i].addr, addr))
+      {
+        entries_[i].active = false;
+        count_--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Sends to the group from the next frame on, replacing a previous group
+  void setMulticast(const StreamMulticastSettings &settings)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry &e = entries_[MULTICAST_INDEX];
+    if (!e.active)
+    {
+      stats_[MULTICAST_INDEX].reset();
+      transport_seq_[MULTICAST_INDEX] = 0;
+      join_generation_[MULTICAST_INDEX]++;
+      count_++;
+    }
+    multicast_ = settings;
+    multicast_generation_++;
+    e.addr = {};
+    e.addr.sin_family = AF_INET;
+    e.addr.sin_addr = settings.group;
+    e.addr.sin_port = htons(settings.port);
+    e.active = true;
+  }
+
+  bool clearMulticast()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!entries_[MULTICAST_INDEX].active)
+      return false;
+    entries_[MULTICAST_INDEX].active = false;
+    multicast_generation_++;
+    count_--;
+    return true;
+  }
+
+  bool multicast(StreamMulticastSettings &out) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out = multicast_;
+    return entries_[MULTICAST_INDEX].active;
+  }
+
+  // Changes whenever the group is set or left; the data task compares it to
+  // apply the socket options on its own socket
+  uint32_t multicastGeneration() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return multicast_generation_;
+  }
+
+  size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  // Copies the current viewers into out (STREAM_MAX_CLIENTS + 1 entries)
+  size_t snapshot(Destination *out) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = 0;
+    for (size_t i = 0; i < capacity_; i++)
+    {
+      if (entries_[i].active)
+        out[n++] = {static_cast<uint8_t>(i), entries_[i].addr};
+    }
+    if (entries_[MULTICAST_INDEX].active)
+      out[n++] = {MULTICAST_INDEX, entries_[MULTICAST_INDEX].addr};
+    return n;
+  }
+
+  // Unicast viewer that feedback from addr belongs to: the same endpoint, the
+  // RTCP port next to it, else the only viewer at that IP. -1 if none.
+  int find(const struct sockaddr_in &addr) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int by_ip = -1;
+    size_t ip_matches = 0;
+    for (size_t i = 0; i < capacity_; i++)
+    {
+      const Entry &e = entries_[i];
+      if (!e.active || e.addr.sin_addr.s_addr != addr.sin_addr.s_addr)
+        continue;
+      uint16_t port = ntohs(addr.sin_port);
+      uint16_t rtp_port = ntohs(e.addr.sin_port);
+      if (port == rtp_port || port == rtp_port + 1)
+        return static_cast<int>(i);
+      by_ip = static_cast<int>(i);
+      ip_matches++;
+    }
+    return ip_matches == 1 ? by_ip : -1;
+  }
+
+  bool address(uint8_t index, struct sockaddr_in &out) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if ((index >= capacity_ && index != MULTICAST_INDEX) || !entries_[index].active)
+      return false;
+    out = entries_[index].addr;
+    return true;
+  }
+
+  StreamClientStats &stats(uint8_t index) { return stats_[index]; }
+  const StreamClientStats &stats(uint8_t index) const { return stats_[index]; }
+
+  // Transport-wide sequence numbers count per receiver
+  uint16_t nextTransportSeq(uint8_t index) { return transport_seq_[index]++; }
+
+  // Changes whenever the slot is handed to a new viewer, see StreamSlotState
+  uint32_t joinGeneration(uint8_t index) const { return join_generation_[index].load(); }
+
+private:
+  struct Entry
+  {
+    bool active = false;
+    struct sockaddr_in addr = {};
+  };
+
+  mutable std::mutex mutex_;
+  size_t capacity_;
+  size_t count_ = 0;
+  Entry entries_[STREAM_MAX_CLIENTS + 1];
+  StreamClientStats stats_[STREAM_MAX_CLIENTS + 1];
+  std::atomic<uint16_t> transport_seq_[STREAM_MAX_CLIENTS + 1] = {};
+  std::atomic<uint32_t> join_generation_[STREAM_MAX_CLIENTS + 1] = {};
+  StreamMulticastSettings multicast_;
+  uint32_t multicast_generation_ = 0;
+
+  static bool sameEndpoint(const struct sockaddr_in &a, const struct sockaddr_in &b)
+  {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+  }
+};
+
+// Per-viewer state kept by one task outside the table, indexed like it. A
+// slot's state starts over from T{} as soon as the table gives the slot to a
+// new viewer, so nothing carries over from the one that stopped before.
+template <typename T>
+class StreamSlotState
+{
+public:
+  T &get(const StreamClientTable &clients, uint8_t index)
+  {
+    uint32_t generation = clients.joinGeneration(index);
+    if (generations_[index] != generation)
+    {
+      slots_[index] = T{};
+      generations_[index] = generation;
+    }
+    return slots_[index];
+  }
+
+private:
+  T slots_[STREAM_MAX_CLIENTS + 1] = {};
+  uint32_t generations_[STREAM_MAX_CLIENTS + 1] = {};
+};
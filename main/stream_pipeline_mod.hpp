@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded lock-free ring for exactly one producer and one consumer task,
+// e.g. on different cores. Each index is written by one side only, so a
+// push or pop is one acquire load and one release store, no lock and no
+// read-modify-write. Standard library only.
+template <typename T>
+class SPSCQueue
+{
+public:
+  explicit SPSCQueue(size_t capacity) : slots_(capacity + 1) {}
+
+  // Producer side; false when full
+  bool push(const T &item)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t next = advance(head);
+    if (next == tail_.load(std::memory_order_acquire))
+      return false;
+    slots_[head] = item;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side; false when empty
+  bool pop(T &item)
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+      return false;
+    item = slots_[tail];
+    tail_.store(advance(tail), std::memory_order_release);
+    return true;
+  }
+
+  // Exact on either side for its own view, approximate from a third task
+  size_t size() const
+  {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return head >= tail ? head - tail : head + slots_.size() - tail;
+  }
+
+  bool full() const { return size() == capacity(); }
+  size_t capacity() const { return slots_.size() - 1; }
+
+private:
+  // One slot stays empty to tell full from empty
+  std::vector<T> slots_;
+  alignas(64) std::atomic<size_t> head_{0}; // next slot to write
+  alignas(64) std::atomic<size_t> tail_{0}; // next slot to read
+
+  size_t advance(size_t index) const { return index + 1 == slots_.size() ? 0 : index + 1; }
+};
+
+// Capture -> send handoff, written by both stages and read by the log line
+// and the info command. Busy time is spent producing (capture + encode) or
+// consuming (packetize + send) a frame, the rest is waiting on the queue.
+struct StreamPipelineStats
+{
+  std::atomic<uint32_t> capacity{0};
+  std::atomic<uint32_t> depth{0};     // frames waiting for the send stage
+  std::atomic<uint32_t> max_depth{0}; // since the last log line
+  std::atomic<uint32_t> stalls{0};    // capture waited for a free slot, total
+  std::atomic<uint32_t> capture_busy_us{0};
+  std::atomic<uint32_t> send_busy_us{0};
+  // Percent of the last log interval each stage was busy
+  std::atomic<uint32_t> capture_load{0};
+  std::atomic<uint32_t> send_load{0};
+
+  void updateDepth(size_t frames)
+  {
+    depth = static_cast<uint32_t>(frames);
+    uint32_t max = max_depth.load();
+    while (frames > max && !max_depth.compare_exchange_weak(max, static_cast<uint32_t>(frames)))
+    {
+    }
+  }
+};
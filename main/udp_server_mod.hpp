@@ -2,11 +2,14 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
 #include "esp_timer.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include <sys/time.h>
 
 // Clear LwIP macro conflicts
 #undef _IO
@@ -16,27 +19,119 @@
 
 #include "video_mod.hpp"
 #include "rtp_packetizer_mod.hpp"
+#include "rtp_jpeg_mod.hpp"
+#include "rtp_pacer_mod.hpp"
+#include "rtp_fec_mod.hpp"
+#include "rtp_retransmit_mod.hpp"
+#include "rtcp_mod.hpp"
+#include "h264_param_cache_mod.hpp"
+#include "stream_clients_mod.hpp"
+#include "stream_pipeline_mod.hpp"
+#include "udp_transport_mod.hpp"
+#include "abr_mod.hpp"
+#include "latency_histogram_mod.hpp"
 #include "cmd_process_mod.hpp"
 
 // Forward declarations
 class V4L2H264Capture;
 
+static_assert(RTCP_MAX_CLIENTS >= STREAM_MAX_CLIENTS + 1, "RTCP needs a stats slot for every viewer and the multicast group");
+
 // Define structs outside the class to avoid initialization order issues
 struct UDPH264StreamerConfig
 {
   // Network settings
   uint16_t control_port = 3334;
+  // RTCP: receiver reports (and NACKs) arrive here, sender reports go to the
+  // client's RTP port + 1
+  uint16_t rtcp_port = 3335;
+  uint32_t rtcp_interval_ms = 1000;
+
+  // Concurrent unicast viewers (up to STREAM_MAX_CLIENTS); every frame is
+  // packetized once and sent to each of them. A multicast group, set with
+  // the multicast command, is sent to in addition and does not count here.
+  size_t max_clients = 4;
+
+  // Packet descriptors sized for the worst-case encoded frame, placed in PSRAM
+  size_t max_frame_bytes = 512 * 1024;
+  bool packet_buffers_internal = false;
+
+  // Spreads large frames over part of the frame interval
+  PacketPacerConfig pacer;
+
+  // Adapts the H.264 bitrate and max QP to TX drops, RTCP loss/RTT and the
+  // send backlog while streaming; changed at runtime with the abr command
+  AbrConfig abr;
+
+  // XOR parity packets per group of media packets (P-frames / IDR frames),
+  // 0 disables; changed at runtime with the fec command
+  uint8_t fec_group = 0;
+  uint8_t fec_key_group = 0;
+
+  // Sent packets kept for NACK retransmission, one MTU each in PSRAM; 0 disables
+  size_t history_packets = 512;
+  // Retransmit as an RFC 4588 RTX stream (PT 97, own SSRC) instead of
+  // resending the original packet unchanged
+  bool rtx_stream = false;
+  size_t nack_queue_length = 64;
+
+  // Media and FEC packets go through the lwIP raw API in one call per batch
+  // instead of one sendmsg() each; switched at runtime with the transport
+  // command
+  bool raw_transport = false;
+
+  // A viewer that lost part of an H.264 frame cannot decode the P-frames
+  // referencing it: they are not sent to it until the next IDR, which is
+  // requested from the encoder right away if enabled
+  bool skip_to_idr_after_loss = true;
+  bool request_idr_after_loss = true;
+
+  // IDRs forced on request (keyframe command, RTCP PLI/FIR, loss, joins) are
+  // at least this far apart; changed at runtime with keyframe:::interval:MS
+  uint32_t keyframe_min_interval_ms = 500;
+
+  // Cached SPS/PPS are always sent in front of the first frame after a client
+  // joins; optionally also in front of every IDR that lacks them
+  bool parameter_sets_before_idr = false;
+
+  // Capture + encode and packetize + send run as separate tasks on both
+  // cores, so the frame rate is bound by the slower stage instead of the sum.
+  // Encoded frames wait for the send stage in a lock-free queue of this many
+  // frames (1 .. V4L2H264Capture::MAX_FRAMES_OUT - 1, one more is being sent).
+  size_t pipeline_depth = 2;
 
   // Task settings
   int stream_task_priority = 20;
   int stream_task_stack_size = 32 * 1024;
+  int stream_task_core = 1;
+  int capture_task_stack_size = 8 * 1024;
+  int capture_task_core = 0;
   int control_task_stack_size = 16 * 1024;
+  int abr_task_stack_size = 4 * 1024;
 };
 
 struct UDPH264StreamerTasks
 {
   TaskHandle_t data = nullptr;
+  TaskHandle_t capture = nullptr;
   TaskHandle_t control = nullptr;
+  TaskHandle_t abr = nullptr;
+};
+
+// Queued by the control task for the data task: sequence number and the
+// viewer it is resent to
+struct UDPH264StreamerNack
+{
+  uint16_t seq;
+  uint8_t client;
+};
+
+// Written by the control (nacked) and data (sent, expired) tasks
+struct UDPH264StreamerRetransmitStats
+{
+  std::atomic<uint32_t> nacked{0};
+  std::atomic<uint32_t> sent{0};
+  std::atomic<uint32_t> expired{0};
 };
 
 class UDPH264Streamer
@@ -46,6 +141,8 @@ public:
 
   using Config = UDPH264StreamerConfig;
   using Tasks = UDPH264StreamerTasks;
+  using RetransmitStats = UDPH264StreamerRetransmitStats;
+  using Nack = UDPH264StreamerNack;
 
   static esp_err_t start(const Config &config = Config())
   {
@@ -56,8 +153,9 @@ public:
     }
 
     config_ = config;
-    video_client_addr_ = {};
     stream_active_ = false;
+    raw_transport_ = config_.raw_transport;
+    keyframes_.setMinInterval(config_.keyframe_min_interval_ms);
 
     capture_ = new V4L2H264Capture({});
     if (!capture_)
@@ -68,7 +166,40 @@ public:
 
     // Initialize components
     cmd_processor_ = std::make_unique<CmdProcessor>();
+    clients_ = std::make_unique<StreamClientTable>(config_.max_clients);
     rtp_packetizer_ = std::make_unique<RTPPacketizer>(esp_random());
+    jpeg_packetizer_ = std::make_unique<RTPJpegPacketizer>(rtp_packetizer_->ssrc(), rtp_packetizer_->mtu());
+    packets_ = config_.packet_buffers_internal
+                   ? std::make_unique<RTPDescriptorList>(config_.max_frame_bytes, rtp_packetizer_->mtu(), allocInternal, heap_caps_free)
+                   : std::make_unique<RTPDescriptorList>(config_.max_frame_bytes, rtp_packetizer_->mtu(), allocPsram, heap_caps_free);
+    if (packets_->capacity() == 0)
+    {
+      ESP_LOGE(TAG, "Failed to allocate packet descriptors");
+      cleanup();
+      return ESP_ERR_NO_MEM;
+    }
+    pacer_ = std::make_unique<PacketPacer>(config_.pacer);
+    abr_ = std::make_unique<AbrController>(config_.abr);
+    size_t depth = std::clamp<size_t>(config_.pipeline_depth, 1, V4L2H264Capture::MAX_FRAMES_OUT - 1);
+    frames_ = std::make_unique<SPSCQueue<V4L2H264Capture::Frame>>(depth);
+    released_frames_ = std::make_unique<SPSCQueue<V4L2H264Capture::Frame>>(V4L2H264Capture::MAX_FRAMES_OUT);
+    pipeline_stats_.capacity = depth;
+    rtcp_ = std::make_unique<RTCPSession>(rtp_packetizer_->ssrc());
+    fec_ = std::make_unique<RTPFecEncoder>(esp_random(), rtp_packetizer_->mtu(), config_.max_frame_bytes,
+                                           allocPsram, heap_caps_free);
+    fec_->configure(config_.fec_group, config_.fec_key_group);
+    if (config_.history_packets > 0)
+    {
+      history_ = std::make_unique<RTPPacketHistory>(config_.history_packets, rtp_packetizer_->mtu(), allocPsram, heap_caps_free);
+      rtx_ = std::make_unique<RTPRtxWriter>(esp_random());
+      nack_queue_ = xQueueCreate(config_.nack_queue_length, sizeof(Nack));
+      if (history_->slots() == 0 || !nack_queue_)
+      {
+        ESP_LOGE(TAG, "Failed to allocate retransmission history");
+        cleanup();
+        return ESP_ERR_NO_MEM;
+      }
+    }
 
     is_running_ = true;
 
@@ -98,6 +229,9 @@ public:
   }
 
 private:
+  static void *allocPsram(size_t size) { return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT); }
+  static void *allocInternal(size_t size) { return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT); }
+
   static bool createTasks()
   {
     // Create control task with higher priority
@@ -114,7 +248,7 @@ private:
     // Create data task
     ret = xTaskCreatePinnedToCore(
         dataTask, "udp_stream", config_.stream_task_stack_size,
-        nullptr, config_.stream_task_priority, &tasks_.data, 1);
+        nullptr, config_.stream_task_priority, &tasks_.data, config_.stream_task_core);
 
     if (ret != pdPASS)
     {
@@ -124,15 +258,55 @@ private:
       return false;
     }
 
+    // Capture stage on the other core, feeding the data task
+    ret = xTaskCreatePinnedToCore(
+        captureTask, "udp_capture", config_.capture_task_stack_size,
+        nullptr, config_.stream_task_priority, &tasks_.capture, config_.capture_task_core);
+
+    if (ret != pdPASS)
+    {
+      ESP_LOGE(TAG, "Failed to create capture task");
+      // The other two tasks exit on their own
+      is_running_ = false;
+      vTaskDelay(pdMS_TO_TICKS(200));
+      return false;
+    }
+
+    // The stream runs without rate adaptation if this fails
+    ret = xTaskCreatePinnedToCore(
+        abrTask, "udp_abr", config_.abr_task_stack_size,
+        nullptr, config_.stream_task_priority - 1, &tasks_.abr, config_.capture_task_core);
+
+    if (ret != pdPASS)
+      ESP_LOGW(TAG, "Failed to create ABR task, bitrate stays fixed");
+
     return true;
   }
 
   static void cleanup()
   {
     cmd_processor_.reset();
+    clients_.reset();
     rtp_packetizer_.reset();
+    jpeg_packetizer_.reset();
+    packets_.reset();
+    pacer_.reset();
+    abr_.reset();
+    frames_.reset();
+    released_frames_.reset();
+    fec_.reset();
+    rtcp_.reset();
+    history_.reset();
+    rtx_.reset();
+    if (nack_queue_)
+    {
+      vQueueDelete(nack_queue_);
+      nack_queue_ = nullptr;
+    }
     tasks_.data = nullptr;
+    tasks_.capture = nullptr;
     tasks_.control = nullptr;
+    tasks_.abr = nullptr;
   }
 
   static bool initializeCapture()
@@ -193,118 +367,754 @@ private:
     return sock;
   }
 
-  static void sendFrame(int sock, const uint8_t *data, size_t size, const struct sockaddr_in &dest)
+  // Packets go out as a header + payload gather list, the payload is read
+  // straight from the encoder buffer without a user-space copy, in batches
+  // through the socket or the lwIP raw API (see UDPTransport). Each FEC
+  // packet follows the last media packet of its group.
+  // The frame's capture time becomes its RTP timestamp, so encode and
+  // queueing jitter do not show up in the receiver's timing. H.264 and JPEG
+  // frames share the send path, SSRC and sequence space.
+  // The frame is packetized once for all viewers. The encoder buffer stays
+  // held until the last viewer has been served, so every viewer's packets
+  // share the same payload spans. Returns false if no viewer got the frame,
+  // otherwise times holds the packetize and send timestamps.
+  static bool sendFrame(UDPTransport &transport, const uint8_t *data, size_t size, const V4L2H264Capture::FrameInfo &info,
+                        FrameTimestamps &times)
   {
-    if (!rtp_packetizer_)
-      return;
+    if (!rtp_packetizer_ || !jpeg_packetizer_ || !packets_ || !pacer_ || !fec_ || !clients_)
+      return false;
 
-    uint64_t ts_us = esp_timer_get_time();
-    auto packets = rtp_packetizer_->packetize(data, size, ts_us);
+    StreamClientTable::Destination clients[STREAM_MAX_CLIENTS + 1];
+    size_t client_count = clients_->snapshot(clients);
+    if (client_count == 0)
+      return false;
+    times.packetize_start_us = esp_timer_get_time();
 
-    for (size_t i = 0; i < packets.size(); i++)
+    bool jpeg = info.codec == V4L2H264Capture::Codec::JPEG;
+    if (info.codec != last_codec_)
     {
-      if (!sendPacket(sock, packets[i], dest, i, packets.size()))
-        return;
+      if (jpeg)
+        jpeg_packetizer_->setSequenceNumber(rtp_packetizer_->sequenceNumber());
+      else
+        rtp_packetizer_->setSequenceNumber(jpeg_packetizer_->sequenceNumber());
+      last_codec_ = info.codec;
     }
-  }
-
-  static bool sendPacket(int sock, const std::vector<uint8_t> &packet,
-                         const struct sockaddr_in &dest, size_t index, size_t total)
-  {
-    int sent = sendto(sock, packet.data(), packet.size(), 0,
-                      (const struct sockaddr *)&dest, sizeof(dest));
-
-    if (sent > 0)
-      return true;
 
-    if (errno == ENOMEM || errno == ENOBUFS)
+    size_t count = 0;
+    bool keyframe = jpeg; // every JPEG frame stands alone
+    if (jpeg)
     {
-      ESP_LOGW(TAG, "Send buffer full, dropping packet %zu/%zu", index + 1, total);
-      taskYIELD();
+      count = jpeg_packetizer_->packetize(data, size, info.capture_us, *packets_);
+      if (count == 0 && jpeg_packetizer_->rejectedFrames() == 1)
+        ESP_LOGW(TAG, "Encoder output is not RFC 2435 compatible JPEG, frames are dropped");
     }
     else
     {
-      ESP_LOGE(TAG, "Send error (packet %zu/%zu): errno=%d", index + 1, total, errno);
+      // Parameter sets ride in front of the frame when a client has just
+      // joined or, if configured, an IDR arrives without them
+      auto frame = parameter_sets_.update(data, size);
+      keyframe = frame.keyframe;
+      bool join = resend_parameter_sets_.exchange(false);
+      bool inject = parameter_sets_.valid() && !frame.parameter_sets &&
+                    (join || (config_.parameter_sets_before_idr && frame.keyframe));
+      const uint8_t *parameter_sets = inject ? parameter_sets_.data() : nullptr;
+      size_t parameter_sets_size = inject ? parameter_sets_.size() : 0;
+
+      count = rtp_packetizer_->packetize(data, size, info.capture_us, *packets_, parameter_sets, parameter_sets_size);
+    }
+
+    if (packets_->frameAllocations() > 0)
+      ESP_LOGW(TAG, "Packet descriptors grew to %zu for a %zu byte frame", packets_->capacity(), size);
+
+    size_t frame_bytes = 0;
+    for (const auto &packet : *packets_)
+      frame_bytes += packet.size();
+
+    size_t fec_count = fec_->protectFrame(*packets_, keyframe);
+    frame_bytes += fec_->arena().bytesUsed();
+    times.packetize_end_us = esp_timer_get_time();
+    times.keyframe = keyframe;
+
+    // A viewer waiting for an IDR does not get this frame. A viewer with a
+    // hard send error is skipped for the rest of the frame.
+    bool skipped[STREAM_MAX_CLIENTS + 1] = {};
+    bool failed[STREAM_MAX_CLIENTS + 1] = {};
+    size_t receivers = client_count;
+    for (size_t c = 0; c < client_count && config_.skip_to_idr_after_loss; c++)
+    {
+      uint8_t index = clients[c].index;
+      ViewerSendState &state = send_state_.get(*clients_, index);
+      if (keyframe)
+      {
+        state.waiting_for_idr = false;
+      }
+      else if (state.waiting_for_idr)
+      {
+        StreamClientStats &stats = clients_->stats(index);
+        stats.skipped_frames++;
+        stats.saved_bytes += frame_bytes;
+        // NACKs for these packets ask for data the viewer was never sent
+        SkippedRange &range = state.skipped;
+        if (count > 0 && !range.active)
+          range = {(*packets_)[0].sequenceNumber(), 0, true};
+        if (count > 0)
+          range.last = (*packets_)[count - 1].sequenceNumber();
+        skipped[c] = failed[c] = true;
+        receivers--;
+      }
+    }
+    if (receivers == 0)
       return false;
+
+    // The pacer spreads the copies for all viewers over the frame window
+    pacer_->beginFrame(frame_bytes * receivers);
+
+    uint32_t frame_delivered[STREAM_MAX_CLIENTS + 1] = {};
+    bool frame_dropped[STREAM_MAX_CLIENTS + 1] = {};
+    size_t sent_bytes = 0;
+    size_t fec_index = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+      serviceRetransmissions(transport.socket());
+      pacer_->waitForSlot(sent_bytes);
+
+      // Every media packet the pacer lets go now, each followed by the FEC
+      // packets of its group, leaves as one batch per viewer
+      struct
+      {
+        UDPDatagram datagrams[UDPTransport::MAX_BATCH];
+        const RTPPacketDescriptor *media[UDPTransport::MAX_BATCH]; // null for FEC
+        size_t count = 0;
+      } batch;
+      do
+      {
+        // Stored before sending so a packet dropped on a full TX queue can
+        // still be recovered by NACK
+        const RTPPacketDescriptor &packet = (*packets_)[i];
+        if (history_)
+          history_->store(packet);
+        batch.media[batch.count] = &packet;
+        batch.datagrams[batch.count++] = {packet.header, packet.header_size, packet.payload, packet.payload_size};
+        sent_bytes += packet.size() * receivers;
+        rtp_packets_sent_++;
+        rtp_octets_sent_ += packet.size() - rtpHeaderLength(packet.header, packet.header_size);
+
+        for (; fec_index < fec_count && (*fec_)[fec_index].after == i; fec_index++)
+        {
+          RTPPacketView parity = (*fec_)[fec_index].view;
+          batch.media[batch.count] = nullptr;
+          batch.datagrams[batch.count++] = {parity.data, parity.size, nullptr, 0};
+          sent_bytes += parity.size * receivers;
+        }
+        i++;
+      } while (i < count && batch.count + 2 <= UDPTransport::MAX_BATCH && pacer_->slotOpen(sent_bytes));
+
+      bool packet_ok[UDPTransport::MAX_BATCH];
+      std::fill(packet_ok, packet_ok + batch.count, true);
+      for (size_t c = 0; c < client_count; c++)
+      {
+        if (failed[c])
+          continue;
+
+        // Header extensions carry the time the batch actually leaves and the
+        // viewer's own transport-wide sequence: only then is the header copied
+        UDPDatagram datagrams[UDPTransport::MAX_BATCH];
+        uint8_t stamped[UDPTransport::MAX_BATCH][RTPPacketDescriptor::MAX_HEADER_SIZE];
+        int64_t send_start_us = esp_timer_get_time();
+        for (size_t k = 0; k < batch.count; k++)
+        {
+          datagrams[k] = batch.datagrams[k];
+          const RTPPacketDescriptor *packet = batch.media[k];
+          if (packet && (packet->header[0] & 0x10))
+          {
+            memcpy(stamped[k], packet->header, packet->header_size);
+            stampHeaderExtensions(stamped[k], send_start_us, clients_->nextTransportSeq(clients[c].index));
+            datagrams[k].header = stamped[k];
+          }
+        }
+
+        bool delivered[UDPTransport::MAX_BATCH];
+        int error = transport.sendBatch(clients[c].addr, datagrams, batch.count, delivered);
+        uint32_t send_us = static_cast<uint32_t>(esp_timer_get_time() - send_start_us);
+        StreamClientStats &stats = clients_->stats(clients[c].index);
+        stats.send_us += send_us;
+        frame_send_us_ += send_us;
+
+        for (size_t k = 0; k < batch.count; k++)
+        {
+          if (!batch.media[k])
+          {
+            if (delivered[k])
+              stats.fec_packets++;
+            continue;
+          }
+          if (delivered[k])
+          {
+            stats.packets++;
+            stats.bytes += datagrams[k].size();
+            frame_delivered[c] += datagrams[k].size();
+          }
+          else
+          {
+            stats.drops++;
+            packet_ok[k] = false;
+            frame_dropped[c] = true;
+          }
+        }
+
+        if (error)
+        {
+          char ip[16];
+          inet_ntoa_r(clients[c].addr.sin_addr, ip, sizeof(ip));
+          ESP_LOGE(TAG, "Send error to %s: errno=%d, skipping the rest of the frame", ip, error);
+          failed[c] = true;
+          frame_dropped[c] = true;
+          stats.errors++;
+        }
+      }
+
+      for (size_t k = 0; k < batch.count; k++)
+      {
+        if (batch.media[k])
+          pacer_->packetSent(packet_ok[k]);
+      }
     }
 
-    return false;
+    bool request_idr = false;
+    uint32_t now_ms = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+    if (keyframe)
+      report_.last_keyframe_ms = now_ms;
+    for (size_t c = 0; c < client_count; c++)
+    {
+      if (skipped[c])
+        continue;
+      StreamClientStats &stats = clients_->stats(clients[c].index);
+      stats.frames++;
+      if (keyframe && !frame_dropped[c])
+        stats.last_keyframe_ms = now_ms;
+
+      // What did arrive of a partial frame is undecodable, and so is every
+      // P-frame after it
+      if (frame_dropped[c] && !jpeg && config_.skip_to_idr_after_loss)
+      {
+        stats.wasted_bytes += frame_delivered[c];
+        ViewerSendState &state = send_state_.get(*clients_, clients[c].index);
+        request_idr |= !state.waiting_for_idr;
+        state.waiting_for_idr = true;
+        state.skipped.active = false;
+      }
+    }
+    if (request_idr && config_.request_idr_after_loss)
+      keyframes_.request();
+    times.sent_us = esp_timer_get_time();
+    return true;
   }
 
-  static void dataTask(void *pvParameters)
+  // Resends the packets NACKed since the last call to the viewer that asked.
+  // Runs on the data task, which owns the history, the control task only
+  // queues requests.
+  static void serviceRetransmissions(int sock)
   {
-    if (!capture_ || !rtp_packetizer_)
-    {
-      vTaskDelete(NULL);
+    if (!nack_queue_ || !history_ || !clients_)
       return;
+
+    Nack nack;
+    while (xQueueReceive(nack_queue_, &nack, 0) == pdTRUE)
+    {
+      struct sockaddr_in dest;
+      if (!clients_->address(nack.client, dest))
+        continue;
+
+      RTPPacketView packet = history_->find(nack.seq);
+      if (!packet.data)
+      {
+        retransmit_stats_.expired++;
+        continue;
+      }
+
+      // The viewer skips to the next IDR anyway, a repaired packet would not
+      // make the frames in between decodable. Packets of skipped frames were
+      // never sent to it and are already counted as saved.
+      const ViewerSendState &state = send_state_.get(*clients_, nack.client);
+      if (state.waiting_for_idr)
+      {
+        const SkippedRange &range = state.skipped;
+        if (!range.active || uint16_t(nack.seq - range.first) > uint16_t(range.last - range.first))
+          clients_->stats(nack.client).saved_bytes += packet.size;
+        continue;
+      }
+
+      if (packet.size + RTP_RTX_OSN_SIZE > sizeof(rtx_buffer_))
+        continue;
+
+      if (config_.rtx_stream)
+      {
+        packet = {rtx_buffer_, rtx_->write(packet, rtx_buffer_)};
+      }
+      else if (packet.data[0] & 0x10)
+      {
+        memcpy(rtx_buffer_, packet.data, packet.size);
+        packet.data = rtx_buffer_;
+      }
+
+      // A retransmission is a new transmission for the transport-wide sequence
+      if (packet.size > 0 && packet.data == rtx_buffer_ && (rtx_buffer_[0] & 0x10))
+        stampHeaderExtensions(rtx_buffer_, esp_timer_get_time(), clients_->nextTransportSeq(nack.client));
+
+      if (packet.size > 0 && sendto(sock, packet.data, packet.size, 0, (const struct sockaddr *)&dest, sizeof(dest)) > 0)
+      {
+        retransmit_stats_.sent++;
+        clients_->stats(nack.client).retransmits++;
+      }
     }
+  }
 
-    int sock = createAndConfigureSocket();
-    if (sock < 0)
+  // Send stage: packetizes and sends the frames the capture task queues,
+  // retransmissions in between
+  static void dataTask(void *pvParameters)
+  {
+    if (!capture_ || !rtp_packetizer_ || !jpeg_packetizer_ || !packets_ || !pacer_ || !frames_)
     {
       vTaskDelete(NULL);
       return;
     }
 
-    // Initialize capture at start
-    if (!initializeCapture())
+    int sock = createAndConfigureSocket();
+    if (sock < 0)
     {
-      ESP_LOGE(TAG, "Failed to start video capture");
-      close(sock);
       vTaskDelete(NULL);
       return;
     }
 
     rtp_packetizer_->resetSequence();
+    last_codec_ = V4L2H264Capture::Codec::H264;
+    UDPTransport transport(sock);
     ESP_LOGI(TAG, "Data task started");
 
+    // Multicast group applied to this socket, left again when it changes
+    uint32_t multicast_generation = 0;
+    struct in_addr joined_group = {};
+
+    // Per-viewer totals at the last rate update
+    uint32_t rate_bytes[STREAM_MAX_CLIENTS + 1] = {};
+    uint32_t rate_frames[STREAM_MAX_CLIENTS + 1] = {};
+
     // FPS tracking variables
     uint32_t frame_count = 0;
+    uint64_t frame_bytes = 0;
     TickType_t last_time = xTaskGetTickCount();
+    struct
+    {
+      uint64_t encode_sum_us = 0;
+      uint32_t encode_max_us = 0;
+      uint64_t queue_sum_us = 0;
+      uint32_t queue_max_us = 0;
+    } latency;
 
     while (is_running_)
     {
-      if (!stream_active_)
+      uint32_t group_generation = clients_->multicastGeneration();
+      if (group_generation != multicast_generation)
       {
-        vTaskDelay(pdMS_TO_TICKS(100));
-        continue;
+        applyMulticast(transport, joined_group);
+        multicast_generation = group_generation;
+      }
+
+      if (raw_transport_ != transport.raw())
+      {
+        if (!transport.setRaw(raw_transport_, TOS_LOW_DELAY))
+          raw_transport_ = false;
+        ESP_LOGI(TAG, "Transport: %s", transport.raw() ? "lwIP raw API" : "socket");
       }
 
-      uint8_t *frame_data = nullptr;
-      size_t frame_size = 0;
-      uint32_t sequence;
+      serviceRetransmissions(sock);
 
-      if (capture_->captureFrame(frame_data, frame_size, sequence))
+      // Woken by the capture task; the timeout (one tick at 100 Hz) keeps
+      // retransmissions going
+      V4L2H264Capture::Frame frame;
+      if (!frames_->pop(frame))
       {
-        sendFrame(sock, frame_data, frame_size, video_client_addr_);
-        frame_count++;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(stream_active_ ? 10 : 100));
+        continue;
       }
-      else
+      pipeline_stats_.updateDepth(frames_->size());
+
+      // Frames still queued when the stream stops only go back
+      if (stream_active_)
       {
-        ESP_LOGW(TAG, "Capture failed");
-        delete capture_;
-        vTaskDelay(pdMS_TO_TICKS(100));
-        capture_ = new V4L2H264Capture({});
-        vTaskDelay(pdMS_TO_TICKS(100));
-        initializeCapture();
-        vTaskDelay(pdMS_TO_TICKS(200));
+        int64_t start_us = esp_timer_get_time();
+
+        // Encoder settings changed or the capture was recreated: the cached
+        // SPS/PPS no longer apply
+        bool restarted = capture_restarted_.exchange(false);
+        if (frame.config_generation != config_generation_ || restarted)
+        {
+          parameter_sets_.invalidate();
+          config_generation_ = frame.config_generation;
+        }
+
+        // Sensor -> encoder output, encoder output -> first packet (includes
+        // the time spent in the pipeline queue)
+        const V4L2H264Capture::FrameInfo &info = frame.info;
+        uint32_t encode_us = static_cast<uint32_t>(info.encoded_us - info.capture_us);
+        uint32_t queue_us = static_cast<uint32_t>(start_us - info.encoded_us);
+        latency.encode_sum_us += encode_us;
+        latency.encode_max_us = std::max(latency.encode_max_us, encode_us);
+        latency.queue_sum_us += queue_us;
+        latency.queue_max_us = std::max(latency.queue_max_us, queue_us);
+
+        FrameTimestamps times;
+        times.capture_us = info.capture_us;
+        times.dequeued_us = info.dequeued_us;
+        times.encoder_queued_us = info.encoder_queued_us;
+        times.encoded_us = info.encoded_us;
+        if (sendFrame(transport, frame.data, frame.size, info, times))
+        {
+          latency_.record(times);
+          report_.frames++;
+        }
+        pipeline_stats_.send_busy_us += static_cast<uint32_t>(esp_timer_get_time() - start_us);
+        frame_count++;
+        frame_bytes += frame.size;
       }
+      returnFrame(frame);
 
       // Log FPS every second
       TickType_t now = xTaskGetTickCount();
       if ((now - last_time) >= pdMS_TO_TICKS(1000))
       {
-        ESP_LOGI(TAG, "FPS: %lu", frame_count);
+        uint32_t interval_ms = pdTICKS_TO_MS(now - last_time);
+        auto pacing = pacer_->takeStats();
+        uint32_t avg_delay = pacing.packets ? static_cast<uint32_t>(pacing.queue_delay_sum_us / pacing.packets) : 0;
+        uint32_t encode_avg = frame_count ? static_cast<uint32_t>(latency.encode_sum_us / frame_count) : 0;
+        uint32_t frame_queue_avg = frame_count ? static_cast<uint32_t>(latency.queue_sum_us / frame_count) : 0;
+        uint32_t kbps = static_cast<uint32_t>(frame_bytes * 8 / interval_ms);
+        size_t viewers = clients_->size();
+        uint32_t send_avg = frame_count ? frame_send_us_ / frame_count : 0;
+        pipeline_stats_.capture_load = pipeline_stats_.capture_busy_us.exchange(0) / (interval_ms * 10);
+        pipeline_stats_.send_load = pipeline_stats_.send_busy_us.exchange(0) / (interval_ms * 10);
+        ESP_LOGI(TAG, "FPS: %lu, %s %lu kbit/s, packet allocations: %lu, paced %lu/%lu, queue delay avg/max %lu/%lu us, "
+                      "drops %lu, nacked %lu, retransmitted %lu, expired %lu",
+                 frame_count, last_codec_ == V4L2H264Capture::Codec::JPEG ? "JPEG" : "H.264", kbps, packets_->totalAllocations(), pacing.paced_frames, pacing.frames,
+                 avg_delay, pacing.queue_delay_max_us, pacing.drops, retransmit_stats_.nacked.load(),
+                 retransmit_stats_.sent.load(), retransmit_stats_.expired.load());
+        ESP_LOGI(TAG, "Capture to encoded avg/max %lu/%lu us, encoded to send avg/max %lu/%lu us",
+                 encode_avg, latency.encode_max_us, frame_queue_avg, latency.queue_max_us);
+        ESP_LOGI(TAG, "Pipeline: depth %lu/%lu (max %lu), capture %lu%% busy, send %lu%% busy, capture stalls %lu",
+                 pipeline_stats_.depth.load(), pipeline_stats_.capacity.load(), pipeline_stats_.max_depth.load(),
+                 pipeline_stats_.capture_load.load(), pipeline_stats_.send_load.load(), pipeline_stats_.stalls.load());
+        ESP_LOGI(TAG, "Viewers: %zu, send time %lu us/frame (%lu per viewer)",
+                 viewers, send_avg, viewers ? send_avg / viewers : 0);
+        updateViewerRates(interval_ms, rate_bytes, rate_frames);
+        report_.fps = frame_count * 1000 / interval_ms;
+        report_.kbps = kbps;
         frame_count = 0;
+        frame_bytes = 0;
+        frame_send_us_ = 0;
+        latency = {};
+        pipeline_stats_.max_depth = pipeline_stats_.depth.load();
         last_time = now;
       }
     }
 
+    // Queued frames go back so the capture can be reconfigured later
+    V4L2H264Capture::Frame frame;
+    while (frames_->pop(frame))
+      returnFrame(frame);
+
     ESP_LOGI(TAG, "Data task closing");
     close(sock);
     vTaskDelete(NULL);
   }
 
+  // Bitrate and frame rate per viewer over the last interval, from the
+  // totals at the previous call. A viewer that joined in between starts
+  // from zero.
+  static void updateViewerRates(uint32_t interval_ms, uint32_t *last_bytes, uint32_t *last_frames)
+  {
+    StreamClientTable::Destination viewers[STREAM_MAX_CLIENTS + 1];
+    size_t count = clients_->snapshot(viewers);
+    for (size_t i = 0; i < count; i++)
+    {
+      uint8_t index = viewers[i].index;
+      StreamClientStats &stats = clients_->stats(index);
+      uint32_t bytes = stats.bytes.load();
+      uint32_t frames = stats.frames.load();
+      if (frames < last_frames[index])
+        last_bytes[index] = last_frames[index] = 0;
+      stats.rate_kbps = static_cast<uint32_t>(static_cast<uint64_t>(bytes - last_bytes[index]) * 8 / interval_ms);
+      stats.rate_fps = (frames - last_frames[index]) * 1000 / interval_ms;
+      last_bytes[index] = bytes;
+      last_frames[index] = frames;
+    }
+  }
+
+  static void returnFrame(const V4L2H264Capture::Frame &frame)
+  {
+    // Sized for every frame that can be out, never full
+    released_frames_->push(frame);
+    if (tasks_.capture)
+      xTaskNotifyGive(tasks_.capture);
+  }
+
+  // Capture stage: sensor frame through the encoder, queued for the data
+  // task. All V4L2 buffer handling happens here, including the frames the
+  // data task is done with.
+  static void captureTask(void *pvParameters)
+  {
+    if (!initializeCapture())
+    {
+      ESP_LOGE(TAG, "Failed to start video capture");
+      vTaskDelete(NULL);
+      return;
+    }
+
+    ESP_LOGI(TAG, "Capture task started");
+    bool stalled = false;
+
+    while (is_running_)
+    {
+      recycleFrames();
+      applyRateControl();
+
+      // updateConfig() waits for the frames to come back before it swaps
+      // the buffers
+      if (!stream_active_ || capture_->reconfiguring())
+      {
+        vTaskDelay(pdMS_TO_TICKS(stream_active_ ? 10 : 100));
+        continue;
+      }
+
+      // Send stage behind: wait for a slot instead of encoding a frame that
+      // could not be queued. Sensor frames are then dropped before the
+      // encoder, which keeps the H.264 reference chain intact.
+      if (frames_->full() || capture_->framesOut() >= V4L2H264Capture::MAX_FRAMES_OUT)
+      {
+        if (!stalled)
+          pipeline_stats_.stalls++;
+        stalled = true;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+        continue;
+      }
+      stalled = false;
+
+      int64_t start_us = esp_timer_get_time();
+      V4L2H264Capture::Frame frame;
+      if (capture_->acquireFrame(frame))
+      {
+        pipeline_stats_.capture_busy_us += static_cast<uint32_t>(esp_timer_get_time() - start_us);
+        frames_->push(frame);
+        pipeline_stats_.updateDepth(frames_->size());
+        if (tasks_.data)
+          xTaskNotifyGive(tasks_.data);
+      }
+      else if (!capture_->reconfiguring())
+      {
+        restartCapture();
+      }
+    }
+
+    recycleFrames();
+    ESP_LOGI(TAG, "Capture task closing");
+    vTaskDelete(NULL);
+  }
+
+  // Publishes the encoder's base max QP for the ABR task and applies its
+  // latest decision and pending IDR requests. Done here, between frames, because this task is the
+  // one that replaces capture_.
+  static void applyRateControl()
+  {
+    const V4L2H264Capture::Config &config = capture_->getConfig();
+    encoder_max_qp_ = config.codec == V4L2H264Capture::Codec::H264 ? V4L2H264Capture::defaultMaxQp(config.quality) : 0;
+
+    uint32_t bitrate = abr_bitrate_.exchange(0);
+    if (bitrate > 0 && !capture_->setRateControl(static_cast<int>(bitrate), abr_max_qp_.load()))
+      ESP_LOGW(TAG, "ABR: encoder refused %lu kbit/s", bitrate / 1000);
+
+    if (keyframes_.due(esp_timer_get_time()))
+      capture_->requestKeyFrame();
+  }
+
+  static void requestRateControl(uint32_t bitrate, int max_qp)
+  {
+    abr_max_qp_ = max_qp;
+    abr_bitrate_ = bitrate;
+  }
+
+  // Rate adaptation: every interval the congestion signals since the last
+  // one go to the controller, a change is handed to the capture task. The
+  // signals are TX queue drops over all viewers, the worst fresh RTCP
+  // receiver report, how long the last frame took to send and capture
+  // stalls behind the send stage.
+  static void abrTask(void *pvParameters)
+  {
+    ESP_LOGI(TAG, "ABR task started");
+    bool active = false;
+    int base_max_qp = 0;
+    uint32_t last_packets = 0, last_drops = 0, last_stalls = 0;
+    uint32_t last_reports[RTCP_MAX_CLIENTS] = {};
+
+    while (is_running_)
+    {
+      vTaskDelay(std::max<TickType_t>(1, pdMS_TO_TICKS(abr_->config().interval_ms)));
+      if (!is_running_)
+        break;
+
+      AbrConfig config = abr_->config();
+      int max_qp = encoder_max_qp_.load(); // 0 while JPEG
+      if (active && !config.enabled && max_qp > 0)
+      {
+        requestRateControl(config.ceiling_bps, max_qp);
+        ESP_LOGI(TAG, "ABR off, bitrate back to %lu kbit/s", config.ceiling_bps / 1000);
+      }
+      if (!stream_active_ || max_qp == 0 || !config.enabled)
+      {
+        active = false;
+        continue;
+      }
+
+      uint32_t packets = 0, drops = 0;
+      StreamClientTable::Destination viewers[STREAM_MAX_CLIENTS + 1];
+      size_t viewer_count = clients_->snapshot(viewers);
+      for (size_t i = 0; i < viewer_count; i++)
+      {
+        const StreamClientStats &stats = clients_->stats(viewers[i].index);
+        packets += stats.packets.load();
+        drops += stats.drops.load();
+      }
+      uint32_t stalls = pipeline_stats_.stalls.load();
+
+      // Only reports received since the last interval count, a viewer that
+      // left must not hold the bitrate down
+      AbrSignals signals;
+      RTCPClientStats reporters[RTCP_MAX_CLIENTS];
+      if (rtcp_)
+        rtcp_->snapshot(reporters);
+      for (size_t i = 0; rtcp_ && i < RTCP_MAX_CLIENTS; i++)
+      {
+        const RTCPClientStats &c = reporters[i];
+        if (c.ssrc == 0 || c.reports == last_reports[i])
+          continue;
+        last_reports[i] = c.reports;
+        if (!c.media_withheld)
+          signals.loss = std::max(signals.loss, c.fraction_lost);
+        signals.rtt_us = std::max(signals.rtt_us, c.rtt_us);
+      }
+
+      // New stream or new encoder settings: start over from the ceiling
+      if (!active || max_qp != base_max_qp)
+      {
+        abr_->reset(active ? abr_->bitrate() : config.ceiling_bps, max_qp);
+        if (!active)
+          requestRateControl(config.ceiling_bps, max_qp);
+        base_max_qp = max_qp;
+        active = true;
+        last_packets = packets;
+        last_drops = drops;
+        last_stalls = stalls;
+        continue;
+      }
+
+      // A viewer joining resets its counters, the sums then go backwards
+      signals.packets = packets >= last_packets ? packets - last_packets : 0;
+      signals.drops = drops >= last_drops ? drops - last_drops : 0;
+      signals.stalls = stalls - last_stalls;
+      signals.backlog = pacer_->backlogPercent();
+      last_packets = packets;
+      last_drops = drops;
+      last_stalls = stalls;
+
+      AbrDecision decision;
+      if (abr_->update(signals, static_cast<uint32_t>(esp_timer_get_time() / 1000), decision))
+      {
+        requestRateControl(decision.to_bps, decision.max_qp);
+        ESP_LOGI(TAG, "ABR: %lu -> %lu kbit/s, max QP %d (%s: loss %.1f%%, drops %lu/%lu, rtt %lu ms, backlog %lu%%, stalls %lu)",
+                 decision.from_bps / 1000, decision.to_bps / 1000, decision.max_qp, abrReasonName(decision.reason),
+                 signals.loss * 100, signals.drops, signals.packets, signals.rtt_us / 1000, signals.backlog, signals.stalls);
+      }
+    }
+
+    ESP_LOGI(TAG, "ABR task closing");
+    vTaskDelete(NULL);
+  }
+
+  static void recycleFrames()
+  {
+    V4L2H264Capture::Frame frame;
+    while (released_frames_->pop(frame))
+      capture_->releaseFrame(frame);
+  }
+
+  // Recreated with the same settings, a JPEG session stays JPEG. Frames the
+  // data task still holds point into the old capture's buffers, so it is
+  // only replaced once all of them are back.
+  static void restartCapture()
+  {
+    ESP_LOGW(TAG, "Capture failed");
+    while (is_running_ && capture_->framesOut() > 0)
+    {
+      recycleFrames();
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    }
+
+    V4L2H264Capture::Config capture_config = capture_->getConfig();
+    delete capture_;
+    vTaskDelay(pdMS_TO_TICKS(100));
+    capture_ = new V4L2H264Capture(capture_config);
+    capture_restarted_ = true;
+    vTaskDelay(pdMS_TO_TICKS(100));
+    initializeCapture();
+    vTaskDelay(pdMS_TO_TICKS(200));
+  }
+
+  // TTL and IGMP membership for the current multicast group. Loopback is
+  // off, the device never receives its own stream. Leaving the old group
+  // sends the IGMP leave so snooping switches stop forwarding to this port.
+  static void applyMulticast(UDPTransport &transport, struct in_addr &joined_group)
+  {
+    int sock = transport.socket();
+    StreamMulticastSettings settings;
+    bool active = clients_->multicast(settings);
+
+    if (joined_group.s_addr != 0 && (!active || !settings.join || joined_group.s_addr != settings.group.s_addr))
+    {
+      struct ip_mreq mreq = {};
+      mreq.imr_multiaddr = joined_group;
+      mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+      setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+      joined_group.s_addr = 0;
+    }
+    if (!active)
+    {
+      ESP_LOGI(TAG, "Multicast output off");
+      return;
+    }
+
+    uint8_t ttl = settings.ttl;
+    uint8_t loop = 0;
+    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+      ESP_LOGW(TAG, "Failed to set multicast TTL: errno=%d", errno);
+    transport.setMulticastTtl(ttl);
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    if (settings.join && joined_group.s_addr == 0)
+    {
+      struct ip_mreq mreq = {};
+      mreq.imr_multiaddr = settings.group;
+      mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+      if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        ESP_LOGW(TAG, "Failed to join multicast group: errno=%d", errno);
+      else
+        joined_group = settings.group;
+    }
+
+    char group[16];
+    inet_ntoa_r(settings.group, group, sizeof(group));
+    ESP_LOGI(TAG, "Multicast output to %s:%u, TTL %u%s", group, settings.port, settings.ttl,
+             joined_group.s_addr != 0 ? ", joined" : "");
+  }
+
   static void controlTask(void *pvParameters)
   {
     int sock = createAndConfigureSocket(config_.control_port, true);
@@ -316,28 +1126,146 @@ private:
 
     ESP_LOGI(TAG, "Control server bound to port %d", config_.control_port);
 
+    int rtcp_sock = createAndConfigureSocket(config_.rtcp_port, true);
+    if (rtcp_sock < 0)
+      ESP_LOGW(TAG, "RTCP disabled");
+    else
+      ESP_LOGI(TAG, "RTCP bound to port %d", config_.rtcp_port);
+
     char buffer[256];
+    uint8_t rtcp_buffer[512];
     struct sockaddr_in source_addr;
     socklen_t addr_len = sizeof(source_addr);
+    int64_t next_report_us = 0;
 
     while (is_running_)
     {
-      int len = recvfrom(sock, buffer, sizeof(buffer) - 1, 0,
-                         (struct sockaddr *)&source_addr, &addr_len);
+      // Wake at least every 100 ms for sender reports and shutdown
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(sock, &fds);
+      if (rtcp_sock >= 0)
+        FD_SET(rtcp_sock, &fds);
+      struct timeval timeout = {0, 100 * 1000};
+      int ready = select(std::max(sock, rtcp_sock) + 1, &fds, nullptr, nullptr, &timeout);
+
+      if (ready > 0 && FD_ISSET(sock, &fds))
+      {
+        addr_len = sizeof(source_addr);
+        int len = recvfrom(sock, buffer, sizeof(buffer) - 1, 0,
+                           (struct sockaddr *)&source_addr, &addr_len);
+
+        if (len > 0 && isRTCPPacket(reinterpret_cast<const uint8_t *>(buffer), len))
+        {
+          processFeedback(reinterpret_cast<const uint8_t *>(buffer), len, source_addr);
+        }
+        else if (len > 0)
+        {
+          buffer[len] = '\0';
+          processCommand(sock, buffer, source_addr);
+        }
+      }
 
-      if (len > 0)
+      if (ready > 0 && rtcp_sock >= 0 && FD_ISSET(rtcp_sock, &fds))
       {
-        buffer[len] = '\0';
-        processCommand(sock, buffer, source_addr);
+        addr_len = sizeof(source_addr);
+        int len = recvfrom(rtcp_sock, rtcp_buffer, sizeof(rtcp_buffer), 0,
+                           (struct sockaddr *)&source_addr, &addr_len);
+        if (len > 0 && isRTCPPacket(rtcp_buffer, len))
+          processFeedback(rtcp_buffer, len, source_addr);
       }
 
-      vTaskDelay(pdMS_TO_TICKS(10));
+      int64_t now_us = esp_timer_get_time();
+      if (rtcp_sock >= 0 && stream_active_ && now_us >= next_report_us)
+      {
+        sendSenderReport(rtcp_sock, now_us);
+        next_report_us = now_us + config_.rtcp_interval_ms * 1000LL;
+      }
     }
 
+    if (rtcp_sock >= 0)
+      close(rtcp_sock);
     close(sock);
     vTaskDelete(NULL);
   }
 
+  // Wall clock as NTP; 1970 based until SNTP has synced, which only offsets
+  // the SR timestamps and does not affect RTT
+  static uint64_t ntpNow()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return ntpFromUnixUs(static_cast<uint64_t>(tv.tv_sec) * 1000000ULL + tv.tv_usec);
+  }
+
+  // One report describes the stream, every viewer gets it on RTP port + 1
+  static void sendSenderReport(int sock, int64_t now_us)
+  {
+    if (!rtcp_ || !clients_)
+      return;
+
+    uint8_t report[128];
+    size_t size = rtcp_->writeSenderReport(report, sizeof(report), ntpNow(), RTPPacketizer::rtpTimestamp(now_us),
+                                           rtp_packets_sent_.load(), rtp_octets_sent_.load());
+    if (size == 0)
+      return;
+
+    StreamClientTable::Destination clients[STREAM_MAX_CLIENTS + 1];
+    size_t client_count = clients_->snapshot(clients);
+    for (size_t c = 0; c < client_count; c++)
+    {
+      struct sockaddr_in dest = clients[c].addr;
+      dest.sin_port = htons(ntohs(dest.sin_port) + 1);
+      sendto(sock, report, size, 0, (const struct sockaddr *)&dest, sizeof(dest));
+    }
+  }
+
+  // RTCP from a receiver: report blocks (RR/SR/XR), RFC 4585 generic NACKs
+  // and PLI/FIR keyframe requests, on the RTCP port or the control port
+  static void processFeedback(const uint8_t *data, size_t size, const struct sockaddr_in &source)
+  {
+    if (rtcp_)
+    {
+      // Frames skipped while waiting for an IDR show up as loss in the
+      // viewer's next report; the ABR must not read that as congestion
+      int client = feedbackClient(source);
+      uint32_t skipped = client >= 0 ? clients_->stats(client).skipped_frames.load() : 0;
+      uint32_t *skipped_at_report = client >= 0 ? &skipped_at_report_.get(*clients_, client) : nullptr;
+      bool withheld = skipped_at_report && skipped != *skipped_at_report;
+      if (rtcp_->processPacket(data, size, ntpNow(), withheld) && skipped_at_report)
+        *skipped_at_report = skipped;
+      if (parseKeyframeRequest(data, size, rtcp_->ssrc()))
+        keyframes_.request();
+    }
+    if (rtp_packetizer_)
+      parseGenericNack(data, size, rtp_packetizer_->ssrc(), [&source](uint16_t seq)
+                       { queueNack(source, seq); });
+  }
+
+  // Requests from addresses that are not unicast viewers are answered on the
+  // multicast group while one is active, otherwise counted and dropped
+  static void queueNack(const struct sockaddr_in &source, uint16_t seq)
+  {
+    retransmit_stats_.nacked++;
+    int client = feedbackClient(source);
+    if (nack_queue_ && client >= 0)
+    {
+      Nack nack = {seq, static_cast<uint8_t>(client)};
+      xQueueSend(nack_queue_, &nack, 0);
+    }
+  }
+
+  // Viewer index feedback from source is about: its unicast entry, else the
+  // multicast group while one is active, else -1
+  static int feedbackClient(const struct sockaddr_in &source)
+  {
+    int client = clients_ ? clients_->find(source) : -1;
+    StreamMulticastSettings multicast;
+    if (client < 0 && clients_ && clients_->multicast(multicast))
+      client = StreamClientTable::MULTICAST_INDEX;
+    return client;
+  }
+
   static void processCommand(int sock, const char *command, struct sockaddr_in &source_addr)
   {
     char source_ip[16];
@@ -349,9 +1277,22 @@ private:
 
     CmdProcessor::Context ctx;
     ctx.stream_active = &stream_active_;
-    ctx.video_client_addr = &video_client_addr_;
+    ctx.clients = clients_.get();
     ctx.source_addr = &source_addr;
     ctx.capture = capture_;
+    ctx.packetizer = rtp_packetizer_.get();
+    ctx.jpeg_packetizer = jpeg_packetizer_.get();
+    ctx.pacer = pacer_.get();
+    ctx.fec = fec_.get();
+    ctx.nack = nack_queue_ ? queueNack : nullptr;
+    ctx.rtcp = rtcp_.get();
+    ctx.resend_parameter_sets = &resend_parameter_sets_;
+    ctx.pipeline = &pipeline_stats_;
+    ctx.raw_transport = &raw_transport_;
+    ctx.abr = abr_.get();
+    ctx.keyframes = &keyframes_;
+    ctx.latency = &latency_;
+    ctx.report = &report_;
 
     auto result = cmd_processor_->process(command, ctx);
 
@@ -368,8 +1309,52 @@ private:
   static inline std::atomic<bool> stream_active_ = false;
   static inline V4L2H264Capture *capture_ = nullptr;
   static inline Config config_;
-  static inline struct sockaddr_in video_client_addr_{};
+  static inline std::unique_ptr<StreamClientTable> clients_;
   static inline Tasks tasks_;
   static inline std::unique_ptr<CmdProcessor> cmd_processor_;
   static inline std::unique_ptr<RTPPacketizer> rtp_packetizer_;
+  static inline std::unique_ptr<RTPJpegPacketizer> jpeg_packetizer_;
+  static inline V4L2H264Capture::Codec last_codec_ = V4L2H264Capture::Codec::H264;
+  static inline std::unique_ptr<RTPDescriptorList> packets_;
+  static inline std::unique_ptr<PacketPacer> pacer_;
+  static inline std::unique_ptr<AbrController> abr_;
+  static inline std::atomic<uint32_t> abr_bitrate_ = 0; // pending for the capture task, 0 = none
+  static inline std::atomic<int> abr_max_qp_ = 0;
+  static inline std::atomic<int> encoder_max_qp_ = 0;
+  static inline KeyframeRequestLimiter keyframes_;
+  static inline PipelineLatency latency_;
+  static inline StreamReportCounters report_;
+  // Media sequence numbers of the frames skipped since the viewer started
+  // waiting for an IDR
+  struct SkippedRange
+  {
+    uint16_t first;
+    uint16_t last;
+    bool active;
+  };
+  struct ViewerSendState
+  {
+    bool waiting_for_idr;
+    SkippedRange skipped;
+  };
+  static inline StreamSlotState<ViewerSendState> send_state_; // data task only
+  static inline StreamSlotState<uint32_t> skipped_at_report_; // control task only
+  static inline std::unique_ptr<RTPFecEncoder> fec_;
+  static inline std::unique_ptr<RTPPacketHistory> history_;
+  static inline std::unique_ptr<RTCPSession> rtcp_;
+  static inline std::atomic<uint32_t> rtp_packets_sent_ = 0;
+  static inline std::atomic<uint32_t> rtp_octets_sent_ = 0;
+  static inline std::unique_ptr<RTPRtxWriter> rtx_;
+  static inline QueueHandle_t nack_queue_ = nullptr;
+  static inline uint8_t rtx_buffer_[RTP_DEFAULT_MTU + RTP_RTX_OSN_SIZE];
+  static inline uint32_t frame_send_us_ = 0;
+  static inline H264ParameterSetCache parameter_sets_;
+  static inline std::atomic<bool> resend_parameter_sets_ = false;
+  static inline uint32_t config_generation_ = 0;
+  static inline std::atomic<bool> capture_restarted_ = false;
+  static inline std::atomic<bool> raw_transport_ = false;
+  static inline std::unique_ptr<SPSCQueue<V4L2H264Capture::Frame>> frames_;
+  static inline std::unique_ptr<SPSCQueue<V4L2H264Capture::Frame>> released_frames_;
+  static inline StreamPipelineStats pipeline_stats_;
+  static inline RetransmitStats retransmit_stats_;
 };
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#include "lwip/ip4.h"
+#include "lwip/netif.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+// One datagram as a gather list of two spans, either may be empty
+struct UDPDatagram
+{
+  const uint8_t *header = nullptr;
+  size_t header_size = 0;
+  const uint8_t *payload = nullptr;
+  size_t payload_size = 0;
+
+  size_t size() const { return header_size + payload_size; }
+};
+
+// Send backend of the streamer. Socket: one sendmsg() per datagram, each
+// paying for the socket layer, the lwIP core lock (a tcpip-thread mailbox
+// round trip without CONFIG_LWIP_TCPIP_CORE_LOCKING) and a route lookup.
+// Raw: a whole batch goes to lwIP in one tcpip_api_call() on a udp_pcb, the
+// route is looked up once per batch, and each datagram is a pbuf chain of
+// the copied header and the payload referenced in place (PBUF_REF). The
+// payload must stay valid until sendBatch() returns; lwIP copies referenced
+// pbufs it has to queue, e.g. while ARP resolves. The pcb shares the
+// socket's local port (SO_REUSEADDR), so packets still sent through the
+// socket, like retransmissions, leave from the same source port.
+class UDPTransport
+{
+public:
+  // Datagrams per core-lock hold, so RX processing is not locked out for a
+  // whole IDR frame
+  static constexpr size_t MAX_BATCH = 16;
+
+  explicit UDPTransport(int sock = -1) : sock_(sock) {}
+  ~UDPTransport() { setRaw(false); }
+
+  UDPTransport(const UDPTransport &) = delete;
+  UDPTransport &operator=(const UDPTransport &) = delete;
+
+  // Switches the backend; false (and stays on the socket) if the pcb cannot
+  // be created
+  bool setRaw(bool raw, uint8_t tos = 0)
+  {
+    if (raw == (pcb_ != nullptr))
+      return true;
+
+    PcbCall call = {};
+    call.self = this;
+    call.tos = tos;
+    call.port = raw ? socketPort() : 0;
+    tcpip_api_call(raw ? openPcb : closePcb, &call.call);
+    if (raw && !pcb_)
+    {
+      ESP_LOGE(TAG, "Failed to create raw UDP pcb");
+      return false;
+    }
+    return true;
+  }
+
+  bool raw() const { return pcb_ != nullptr; }
+  int socket() const { return sock_; }
+
+  // The socket's TTL is set with setsockopt(), the pcb keeps its own
+  void setMulticastTtl(uint8_t ttl)
+  {
+    multicast_ttl_ = ttl;
+    if (pcb_)
+    {
+      PcbCall call = {};
+      call.self = this;
+      tcpip_api_call(applyTtl, &call.call);
+    }
+  }
+
+  // Sends up to MAX_BATCH datagrams to dest. delivered[i] tells whether
+  // datagram i was accepted; a full TX queue (ENOMEM / ERR_MEM) only drops
+  // that datagram, any other error ends the batch and is returned as an
+  // errno value (0 if none).
+  int sendBatch(const struct sockaddr_in &dest, const UDPDatagram *datagrams, size_t count, bool *delivered)
+  {
+    count = std::min(count, MAX_BATCH);
+    std::fill(delivered, delivered + count, false);
+    return pcb_ ? sendRaw(dest, datagrams, count, delivered) : sendSocket(dest, datagrams, count, delivered);
+  }
+
+private:
+  static constexpr const char *TAG = "UDP_TRANSPORT";
+
+  int sock_;
+  struct udp_pcb *pcb_ = nullptr;
+  uint8_t multicast_ttl_ = 1;
+
+  struct PcbCall
+  {
+    struct tcpip_api_call_data call; // first, tcpip_api_call() passes a pointer to it
+    UDPTransport *self;
+    uint8_t tos;
+    uint16_t port; // local port to bind the pcb to, 0 = ephemeral
+  };
+
+  // Local port of the socket, binding it to an ephemeral one first if it has
+  // not sent yet. Marks it reusable so the pcb can bind the same port.
+  uint16_t socketPort()
+  {
+    if (sock_ < 0)
+      return 0;
+    int reuse = 1;
+    setsockopt(sock_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in local = {};
+    socklen_t len = sizeof(local);
+    if (getsockname(sock_, (struct sockaddr *)&local, &len) == 0 && local.sin_port == 0)
+    {
+      local.sin_family = AF_INET;
+      local.sin_addr.s_addr = htonl(INADDR_ANY);
+      bind(sock_, (struct sockaddr *)&local, sizeof(local));
+      len = sizeof(local);
+      getsockname(sock_, (struct sockaddr *)&local, &len);
+    }
+    return ntohs(local.sin_port);
+  }
+
+  struct BatchCall
+  {
+    struct tcpip_api_call_data call;
+    struct udp_pcb *pcb;
+    const struct sockaddr_in *dest;
+    const UDPDatagram *datagrams;
+    size_t count;
+    bool *delivered;
+    err_t error;
+  };
+
+  int sendSocket(const struct sockaddr_in &dest, const UDPDatagram *datagrams, size_t count, bool *delivered)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      struct iovec iov[2];
+      iov[0].iov_base = const_cast<uint8_t *>(datagrams[i].header);
+      iov[0].iov_len = datagrams[i].header_size;
+      iov[1].iov_base = const_cast<uint8_t *>(datagrams[i].payload);
+      iov[1].iov_len = datagrams[i].payload_size;
+
+      struct msghdr msg = {};
+      msg.msg_name = const_cast<struct sockaddr_in *>(&dest);
+      msg.msg_namelen = sizeof(dest);
+      msg.msg_iov = iov;
+      msg.msg_iovlen = datagrams[i].payload_size ? 2 : 1;
+
+      if (sendmsg(sock_, &msg, 0) > 0)
+      {
+        delivered[i] = true;
+        continue;
+      }
+      if (errno != ENOMEM && errno != ENOBUFS)
+        return errno;
+      taskYIELD();
+    }
+    return 0;
+  }
+
+  int sendRaw(const struct sockaddr_in &dest, const UDPDatagram *datagrams, size_t count, bool *delivered)
+  {
+    BatchCall call = {};
+    call.pcb = pcb_;
+    call.dest = &dest;
+    call.datagrams = datagrams;
+    call.count = count;
+    call.delivered = delivered;
+    tcpip_api_call(sendBatchLocked, &call.call);
+    if (call.error == ERR_OK)
+      return 0;
+    return call.error == ERR_RTE ? EHOSTUNREACH : EIO;
+  }
+
+  // Runs with the lwIP core locked (or on the tcpip thread)
+  static err_t sendBatchLocked(struct tcpip_api_call_data *data)
+  {
+    auto *call = reinterpret_cast<BatchCall *>(data);
+    ip_addr_t ip;
+    ip_addr_set_ip4_u32(&ip, call->dest->sin_addr.s_addr);
+    uint16_t port = ntohs(call->dest->sin_port);
+
+    struct netif *netif = ip4_route(ip_2_ip4(&ip));
+    if (!netif)
+    {
+      call->error = ERR_RTE;
+      return ERR_OK;
+    }
+
+    for (size_t i = 0; i < call->count; i++)
+    {
+      const UDPDatagram &d = call->datagrams[i];
+      // Room for the UDP, IP and link headers in front of the RTP header
+      struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, d.header_size, PBUF_RAM);
+      if (!p)
+        continue;
+      memcpy(p->payload, d.header, d.header_size);
+      if (d.payload_size)
+      {
+        struct pbuf *payload = pbuf_alloc(PBUF_RAW, d.payload_size, PBUF_REF);
+        if (!payload)
+        {
+          pbuf_free(p);
+          continue;
+        }
+        payload->payload = const_cast<uint8_t *>(d.payload);
+        pbuf_cat(p, payload);
+      }
+
+      err_t err = udp_sendto_if(call->pcb, p, &ip, port, netif);
+      pbuf_free(p);
+      if (err == ERR_OK)
+        call->delivered[i] = true;
+      else if (err != ERR_MEM && err != ERR_BUF)
+      {
+        call->error = err;
+        break;
+      }
+    }
+    return ERR_OK;
+  }
+
+  static err_t openPcb(struct tcpip_api_call_data *data)
+  {
+    auto *call = reinterpret_cast<PcbCall *>(data);
+    struct udp_pcb *pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (!pcb)
+      return ERR_MEM;
+    ip_set_option(pcb, SOF_REUSEADDR);
+    if (call->port && udp_bind(pcb, IP4_ADDR_ANY, call->port) != ERR_OK)
+    {
+      ESP_LOGW(TAG, "Cannot share port %u with the socket, raw packets use their own source port", call->port);
+      call->port = 0;
+    }
+    if (!call->port && udp_bind(pcb, IP4_ADDR_ANY, 0) != ERR_OK)
+    {
+      udp_remove(pcb);
+      return ERR_USE;
+    }
+    pcb->tos = call->tos;
+    udp_set_multicast_ttl(pcb, call->self->multicast_ttl_);
+    call->self->pcb_ = pcb;
+    return ERR_OK;
+  }
+
+  static err_t closePcb(struct tcpip_api_call_data *data)
+  {
+    auto *call = reinterpret_cast<PcbCall *>(data);
+    if (call->self->pcb_)
+      udp_remove(call->self->pcb_);
+    call->self->pcb_ = nullptr;
+    return ERR_OK;
+  }
+
+  static err_t applyTtl(struct tcpip_api_call_data *data)
+  {
+    auto *call = reinterpret_cast<PcbCall *>(data);
+    if (call->self->pcb_)
+      udp_set_multicast_ttl(call->self->pcb_, call->self->multicast_ttl_);
+    return ERR_OK;
+  }
+};
+
+// Result of one UDPTransportBench run; CPU shares are of all cores over the
+// run, from the FreeRTOS run-time counters
+struct UDPTransportBenchResult
+{
+  uint32_t sent = 0;
+  uint32_t dropped = 0;
+  uint32_t elapsed_us = 0;
+  float cpu_percent = 0;   // all tasks (100 - idle)
+  float tcpip_percent = 0; // lwIP tcpip thread
+  float sender_percent = 0;
+
+  uint32_t packetsPerSecond() const { return elapsed_us ? static_cast<uint32_t>(sent * 1000000ULL / elapsed_us) : 0; }
+};
+
+// Packets/s and CPU cost of both backends with RTP-sized datagrams, sent as
+// fast as the stack accepts them. Runs on the calling task.
+class UDPTransportBench
+{
+public:
+  static UDPTransportBenchResult run(UDPTransport &transport, const struct sockaddr_in &dest,
+                                     size_t packets, size_t payload_size)
+  {
+    static uint8_t payload[RTP_BENCH_MAX_PAYLOAD];
+    static uint8_t header[RTP_BENCH_HEADER_SIZE] = {0x80, 96};
+    payload_size = std::min(payload_size, sizeof(payload));
+
+    UDPDatagram batch[UDPTransport::MAX_BATCH];
+    bool delivered[UDPTransport::MAX_BATCH];
+    for (auto &d : batch)
+      d = {header, sizeof(header), payload, payload_size};
+
+    UDPTransportBenchResult result;
+    CpuSample before = sample();
+    int64_t start_us = esp_timer_get_time();
+
+    for (size_t sent = 0; sent < packets;)
+    {
+      size_t n = std::min(UDPTransport::MAX_BATCH, packets - sent);
+      int error = transport.sendBatch(dest, batch, n, delivered);
+      for (size_t i = 0; i < n; i++)
+        delivered[i] ? result.sent++ : result.dropped++;
+      sent += n;
+      if (error)
+        break;
+      // Let the Wi-Fi driver drain instead of spinning on a full queue
+      if (!delivered[n - 1])
+        vTaskDelay(1);
+    }
+
+    result.elapsed_us = static_cast<uint32_t>(esp_timer_get_time() - start_us);
+    CpuSample after = sample();
+    uint32_t total = (after.total - before.total) * portNUM_PROCESSORS;
+    if (total > 0)
+    {
+      result.cpu_percent = 100.0f - (after.idle - before.idle) * 100.0f / total;
+      result.tcpip_percent = (after.tcpip - before.tcpip) * 100.0f / total;
+      result.sender_percent = (after.self - before.self) * 100.0f / total;
+    }
+    return result;
+  }
+
+private:
+  static constexpr size_t RTP_BENCH_MAX_PAYLOAD = 1400;
+  static constexpr size_t RTP_BENCH_HEADER_SIZE = 12;
+  static constexpr size_t MAX_TASKS = 48;
+
+  struct CpuSample
+  {
+    uint32_t total = 0;
+    uint32_t idle = 0;
+    uint32_t tcpip = 0;
+    uint32_t self = 0;
+  };
+
+  static CpuSample sample()
+  {
+    static TaskStatus_t tasks[MAX_TASKS];
+    CpuSample s;
+    UBaseType_t count = uxTaskGetSystemState(tasks, MAX_TASKS, &s.total);
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+      if (strncmp(tasks[i].pcTaskName, "IDLE", 4) == 0)
+        s.idle += tasks[i].ulRunTimeCounter;
+      else if (strcmp(tasks[i].pcTaskName, "tiT") == 0)
+        s.tcpip = tasks[i].ulRunTimeCounter;
+      if (tasks[i].xHandle == self)
+        s.self = tasks[i].ulRunTimeCounter;
+    }
+    return s;
+  }
+};
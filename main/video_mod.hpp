@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <cstddef>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <chrono>
 #include <fcntl.h>
@@ -12,20 +14,102 @@
 #include <linux/videodev2.h>
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
+
+// IDR requests from viewers (keyframe command, RTCP PLI/FIR, loss
+// recovery, joins) are coalesced so several viewers cannot force an IDR
+// storm: at most one forced IDR per min interval, a request inside the
+// interval is served when it ends. request() from any task, due() from the
+// one owning the capture.
+class KeyframeRequestLimiter
+{
+public:
+  KeyframeRequestLimiter() = default;
+  explicit KeyframeRequestLimiter(uint32_t min_interval_ms) : min_interval_ms_(min_interval_ms) {}
+
+  void request()
+  {
+    requested_++;
+    pending_ = true;
+  }
+
+  // True if an IDR should be forced now
+  bool due(int64_t now_us)
+  {
+    if (!pending_.load() || now_us - last_forced_us_ < static_cast<int64_t>(min_interval_ms_.load()) * 1000)
+      return false;
+    pending_ = false;
+    last_forced_us_ = now_us;
+    forced_++;
+    return true;
+  }
+
+  void setMinInterval(uint32_t ms) { min_interval_ms_ = ms; }
+  uint32_t minIntervalMs() const { return min_interval_ms_.load(); }
+  uint32_t requested() const { return requested_.load(); }
+  uint32_t forced() const { return forced_.load(); }
+
+private:
+  std::atomic<uint32_t> min_interval_ms_{500};
+  std::atomic<bool> pending_{false};
+  std::atomic<uint32_t> requested_{0};
+  std::atomic<uint32_t> forced_{0};
+  int64_t last_forced_us_ = INT64_MIN / 2;
+};
 
 class V4L2H264Capture
 {
 public:
+  // H.264 on the video encoder, or intra-only JPEG on the JPEG encoder for
+  // receivers that cannot decode H.264
+  enum class Codec
+  {
+    H264,
+    JPEG,
+  };
+
   struct Config
   {
     const char *capture_device = "/dev/video0";
-    int i_period = 30;
-    int quality = 40;
+    Codec codec = Codec::H264;
+    int i_period = 120; // IDRs on demand cover loss and joins, see KeyframeRequestLimiter
+    int quality = 40;      // H.264 QP
+    int bitrate = 25000000; // H.264 rate control target, bits/s
+    int max_qp = 0;         // H.264, 0 = quality + 5
+    int jpeg_quality = 80; // 1..100
     int exposure = 80;
     int width = 1280;
     int height = 960;
   };
 
+  // Per-frame metadata, times on the esp_timer clock (microseconds since boot)
+  struct FrameInfo
+  {
+    Codec codec = Codec::H264;
+    int64_t capture_us = 0;  // sensor frame time, see captureTime()
+    int64_t dequeued_us = 0; // raw frame taken from the capture device
+    int64_t encoder_queued_us = 0; // raw frame queued to the encoder
+    int64_t encoded_us = 0;  // encoded frame taken from the encoder
+  };
+
+  // Encoded frame held out of the encoder until releaseFrame(frame), so it
+  // can be handed to another task. Up to MAX_FRAMES_OUT are held at once.
+  struct Frame
+  {
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    uint32_t sequence = 0;
+    FrameInfo info;
+    // Bumped by every updateConfig(), lets consumers drop state derived from
+    // the previous encoder setup (e.g. cached SPS/PPS)
+    uint32_t config_generation = 0;
+    int index = -1;
+    uint32_t buffer_generation = 0;
+  };
+
+  // Leaves the encoder at least two capture buffers to write into
+  static constexpr int MAX_FRAMES_OUT = 3;
+
   explicit V4L2H264Capture(const Config &config) : config_(config) {}
 
   ~V4L2H264Capture()
@@ -47,7 +131,7 @@ public:
       return ESP_FAIL;
     }
 
-    encoding_fd_ = open(H264_DEVICE_PATH, O_RDWR | O_NONBLOCK);
+    encoding_fd_ = open(encoderDevice(), O_RDWR | O_NONBLOCK);
     if (encoding_fd_ < 0)
     {
       ESP_LOGE(TAG, "Failed to open encoder device");
@@ -79,25 +163,130 @@ public:
 
   void updateConfig(const Config &config)
   {
+    // Frames from acquireFrame() point into buffers that are unmapped below;
+    // wait for their holder to release them, bounded so a stuck holder does
+    // not block the control path
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      draining_ = true;
+    }
+    for (int waited = 0; frames_out_.load() > 0 && waited < DRAIN_TIMEOUT_MS; waited++)
+      usleep(1000);
+    if (frames_out_.load() > 0)
+      ESP_LOGW(TAG, "Reconfiguring with %d frames still held", frames_out_.load());
+
     std::lock_guard<std::mutex> lock(mutex_);
 
     stopInternal();
 
     config_ = config;
+    config_generation_++;
 
     closeEncoder();
     openEncoder();
     configureEncoder();
 
     startInternal();
+    draining_ = false;
   }
 
-  bool captureFrame(uint8_t *&data, size_t &size, uint32_t &sequence)
+  // H.264 rate control without restarting the stream: the encoder applies
+  // the new target from the next frame. Kept in the config, so a later
+  // updateConfig() starts with it. False for JPEG or if the driver refuses.
+  bool setRateControl(int bitrate, int max_qp)
   {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!streaming_)
+    if (encoding_fd_ < 0 || config_.codec != Codec::H264)
       return false;
 
+    max_qp = std::clamp(max_qp, std::max(1, config_.quality), 51);
+    bool ok = setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_BITRATE, bitrate, "BITRATE") &&
+              setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_H264_MAX_QP, max_qp, "MAX_QP");
+    if (ok)
+    {
+      config_.bitrate = bitrate;
+      config_.max_qp = max_qp;
+    }
+    return ok;
+  }
+
+  // The next H.264 frame out of the encoder is an IDR, so receivers that
+  // lost part of the stream can decode again without waiting for i_period
+  bool requestKeyFrame()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoding_fd_ < 0 || config_.codec != Codec::H264)
+      return false;
+    return setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1, "FORCE_KEY_FRAME");
+  }
+
+  // Max QP the encoder is configured with when max_qp is left at 0
+  static int defaultMaxQp(int quality) { return std::min(51, quality + 5); }
+
+  // Captures and encodes one frame. On success the encoder buffer behind
+  // frame.data stays dequeued until releaseFrame(frame), so it can be handed
+  // to another task and sent zero-copy. False also while MAX_FRAMES_OUT are
+  // held or updateConfig() waits for them, see reconfiguring().
+  bool acquireFrame(Frame &frame)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!streaming_ || draining_ || frames_out_.load() >= MAX_FRAMES_OUT)
+      return false;
+
+    if (!encodeFrame(frame.data, frame.size, frame.sequence, frame.info, frame.index))
+      return false;
+    frame.config_generation = config_generation_.load();
+    frame.buffer_generation = buffer_generation_;
+    frames_out_++;
+    return true;
+  }
+
+  // Frames from before a reconfiguration are only counted, their buffers
+  // went back to the driver with the old stream
+  void releaseFrame(const Frame &frame)
+  {
+    if (frame.index < 0)
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_out_--;
+    if (streaming_ && frame.buffer_generation == buffer_generation_)
+      queueEncoderBuffer(frame.index);
+  }
+
+  bool reconfiguring() const { return draining_.load(); }
+  int framesOut() const { return frames_out_.load(); }
+
+  const Config &getConfig() const { return config_; }
+
+private:
+  static const char *TAG;
+  static constexpr const char *H264_DEVICE_PATH = "/dev/video11";
+  static constexpr const char *JPEG_DEVICE_PATH = "/dev/video10";
+  static constexpr int BUFFER_COUNT = 3;
+  static constexpr int ENCODER_BUFFER_COUNT = 5;
+  static constexpr int FRAME_TIMEOUT_MS = 5;
+  static constexpr int DRAIN_TIMEOUT_MS = 500;
+  static_assert(MAX_FRAMES_OUT <= ENCODER_BUFFER_COUNT - 2);
+
+  Config config_;
+  int capture_fd_ = -1, encoding_fd_ = -1;
+  uint8_t *cap_buffer_[BUFFER_COUNT] = {nullptr};
+  uint8_t *enc_buffers_[ENCODER_BUFFER_COUNT] = {nullptr};
+  size_t enc_buffer_size_ = 0;
+  uint32_t frame_sequence_ = 0;
+  std::atomic<uint32_t> config_generation_{0};
+  std::atomic<int> frames_out_{0};
+  std::atomic<bool> draining_{false};
+  uint32_t buffer_generation_ = 0; // bumped whenever the buffers are torn down
+  bool initialized_ = false, streaming_ = false;
+  std::mutex mutex_;
+
+  // One raw frame through the encoder; index is the encoder capture buffer
+  // left dequeued for the caller. Called with mutex_ held.
+  bool encodeFrame(uint8_t *&data, size_t &size, uint32_t &sequence, FrameInfo &info, int &index)
+  {
+    index = -1;
     struct v4l2_buffer cap_buf;
     memset(&cap_buf, 0, sizeof(cap_buf));
     cap_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -106,6 +295,10 @@ public:
     if (!dequeueBuffer(capture_fd_, &cap_buf, FRAME_TIMEOUT_MS))
       return false;
 
+    info.codec = config_.codec;
+    info.dequeued_us = esp_timer_get_time();
+    info.capture_us = captureTime(cap_buf, info.dequeued_us);
+
     struct v4l2_buffer enc_out_buf;
     memset(&enc_out_buf, 0, sizeof(enc_out_buf));
     enc_out_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
@@ -113,6 +306,7 @@ public:
     enc_out_buf.m.userptr = (unsigned long)cap_buffer_[cap_buf.index];
     enc_out_buf.length = cap_buf.bytesused;
 
+    info.encoder_queued_us = esp_timer_get_time();
     if (ioctl(encoding_fd_, VIDIOC_QBUF, &enc_out_buf) < 0)
     {
       ioctl(capture_fd_, VIDIOC_QBUF, &cap_buf);
@@ -135,6 +329,7 @@ public:
       return false;
     }
 
+    info.encoded_us = esp_timer_get_time();
     ioctl(capture_fd_, VIDIOC_QBUF, &cap_buf);
 
     struct v4l2_buffer enc_out_debuf;
@@ -146,35 +341,32 @@ public:
     data = enc_buffers_[enc_cap_buf.index];
     size = enc_cap_buf.bytesused;
     sequence = frame_sequence_++;
+    index = enc_cap_buf.index;
+
+    return true;
+  }
+
+  // The driver's buffer timestamp when it is set and on the esp_timer clock
+  // (not after the dequeue and at most a second before it), otherwise the
+  // dequeue time as the closest stand-in
+  static int64_t captureTime(const struct v4l2_buffer &buf, int64_t dequeued_us)
+  {
+    int64_t ts = static_cast<int64_t>(buf.timestamp.tv_sec) * 1000000LL + buf.timestamp.tv_usec;
+    if (ts > 0 && ts <= dequeued_us && dequeued_us - ts < 1000000LL)
+      return ts;
+    return dequeued_us;
+  }
 
+  void queueEncoderBuffer(int index)
+  {
     struct v4l2_buffer enc_cap_qbuf;
     memset(&enc_cap_qbuf, 0, sizeof(enc_cap_qbuf));
     enc_cap_qbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     enc_cap_qbuf.memory = V4L2_MEMORY_MMAP;
-    enc_cap_qbuf.index = enc_cap_buf.index;
+    enc_cap_qbuf.index = index;
     ioctl(encoding_fd_, VIDIOC_QBUF, &enc_cap_qbuf);
-
-    return true;
   }
 
-  const Config &getConfig() const { return config_; }
-
-private:
-  static const char *TAG;
-  static constexpr const char *H264_DEVICE_PATH = "/dev/video11";
-  static constexpr int BUFFER_COUNT = 3;
-  static constexpr int ENCODER_BUFFER_COUNT = 5;
-  static constexpr int FRAME_TIMEOUT_MS = 5;
-
-  Config config_;
-  int capture_fd_ = -1, encoding_fd_ = -1;
-  uint8_t *cap_buffer_[BUFFER_COUNT] = {nullptr};
-  uint8_t *enc_buffers_[ENCODER_BUFFER_COUNT] = {nullptr};
-  size_t enc_buffer_size_ = 0;
-  uint32_t frame_sequence_ = 0;
-  bool initialized_ = false, streaming_ = false;
-  std::mutex mutex_;
-
   void stopInternal()
   {
     int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -184,6 +376,7 @@ private:
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ioctl(capture_fd_, VIDIOC_STREAMOFF, &type);
     cleanupBuffers();
+    buffer_generation_++;
     streaming_ = false;
   }
 
@@ -212,13 +405,18 @@ private:
 
     streaming_ = true;
     frame_sequence_ = 0;
-    ESP_LOGI(TAG, "Capture started: %dx%d GOP=%d quality=%d", config_.width, config_.height, config_.i_period, config_.quality);
+    if (config_.codec == Codec::JPEG)
+      ESP_LOGI(TAG, "Capture started: %dx%d JPEG quality=%d", config_.width, config_.height, config_.jpeg_quality);
+    else
+      ESP_LOGI(TAG, "Capture started: %dx%d H.264 GOP=%d quality=%d", config_.width, config_.height, config_.i_period, config_.quality);
     return true;
   }
 
+  const char *encoderDevice() const { return config_.codec == Codec::JPEG ? JPEG_DEVICE_PATH : H264_DEVICE_PATH; }
+
   void openEncoder()
   {
-    encoding_fd_ = open(H264_DEVICE_PATH, O_RDWR | O_NONBLOCK);
+    encoding_fd_ = open(encoderDevice(), O_RDWR | O_NONBLOCK);
     if (encoding_fd_ < 0)
       ESP_LOGE(TAG, "Failed to open encoder");
   }
@@ -237,21 +435,30 @@ private:
     if (encoding_fd_ < 0)
       return;
 
-    setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_BITRATE, 25000000, "BITRATE");
-    setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, config_.i_period, "I_PERIOD");
+    if (config_.codec == Codec::JPEG)
+    {
+      setControl(encoding_fd_, V4L2_CID_JPEG_CLASS, V4L2_CID_JPEG_COMPRESSION_QUALITY,
+                 std::clamp(config_.jpeg_quality, 1, 100), "JPEG_QUALITY");
+    }
+    else
+    {
+      setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_BITRATE, config_.bitrate, "BITRATE");
+      setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, config_.i_period, "I_PERIOD");
 
-    setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_H264_MIN_QP, std::max(1, config_.quality), "MIN_QP");
-    setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_H264_MAX_QP, std::min(51, config_.quality + 5), "MAX_QP");
+      setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_H264_MIN_QP, std::max(1, config_.quality), "MIN_QP");
+      int max_qp = config_.max_qp > 0 ? std::clamp(config_.max_qp, std::max(1, config_.quality), 51) : defaultMaxQp(config_.quality);
+      setControl(encoding_fd_, V4L2_CID_CODEC_CLASS, V4L2_CID_MPEG_VIDEO_H264_MAX_QP, max_qp, "MAX_QP");
+    }
 
     setControl(capture_fd_, V4L2_CTRL_CLASS_USER, V4L2_CID_EXPOSURE, config_.exposure, "EXPOSURE");
     setControl(capture_fd_, V4L2_CTRL_CLASS_USER, V4L2_CID_VFLIP, 1, "VFLIP");
     setControl(capture_fd_, V4L2_CTRL_CLASS_USER, V4L2_CID_HFLIP, 0, "HFLIP");
   }
 
-  void setControl(int fd, uint32_t ctrl_class, uint32_t id, int32_t value, const char *param)
+  bool setControl(int fd, uint32_t ctrl_class, uint32_t id, int32_t value, const char *param)
   {
     if (fd < 0)
-      return;
+      return false;
 
     struct v4l2_ext_control ctrl;
     memset(&ctrl, 0, sizeof(ctrl));
@@ -265,9 +472,12 @@ private:
     ctrls.controls = &ctrl;
 
     if (ioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls) != 0)
+    {
       ESP_LOGW(TAG, "Failed to set %s=%d", param, value);
-    else
-      ESP_LOGI(TAG, "Set %s = %d", param, value);
+      return false;
+    }
+    ESP_LOGI(TAG, "Set %s = %d", param, value);
+    return true;
   }
 
   bool setupCapture()
@@ -337,7 +547,7 @@ private:
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     fmt.fmt.pix.width = config_.width;
     fmt.fmt.pix.height = config_.height;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_H264;
+    fmt.fmt.pix.pixelformat = config_.codec == Codec::JPEG ? V4L2_PIX_FMT_JPEG : V4L2_PIX_FMT_H264;
     if (ioctl(encoding_fd_, VIDIOC_S_FMT, &fmt) < 0)
       return false;
 